@@ -0,0 +1,533 @@
+// Benchmark.cpp
+// Headless benchmark of the CPU solvers (PBF_SystemT and SPH_System): no window,
+// no GL context. Runs each solver for a number of frames at the requested particle
+// counts and writes per-stage timings and throughput as JSON.
+//
+//   SPHfluid_benchmark [--solver pbf|sph|all] [--particles 5400,10800] [--frames 20]
+//                      [--warmup 2] [--precision float|double] [--threads N] [--out file.json]
+//                      [--cell-keys linear|morton] [--pairs full|half]
+//                      [--verlet-skin F]  (PBF Verlet lists, skin as a fraction of the kernel radius)
+//                      [--validate]       (adds the PBF float/double and thread determinism checks,
+//                                          the SPH checks and the allocation check; exits with 1 if
+//                                          any of them fails)
+//                      [--pair-kernels]   (adds the SPH pair throughput, libm loop vs packed kernels)
+#define SPHFLUID_ALLOCATION_COUNTER_IMPL
+#include "../support/AllocationCounter.h"
+
+#include "../physics/PBF_System.h"
+#include "../physics/PBF_Validation.h"
+#include "../physics/SPH_System.h"
+#include "../physics/SPH_Validation.h"
+#include "../physics/maths/Simd.h"
+#include "../physics/maths/SphPairKernels.h"
+#include "../support/Timer.h"
+
+#include <omp.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct Options
+    {
+        std::string      solver = "all";
+        std::vector<int> particles = { 5400, 10800 };
+        int              frames = 20;
+        int              warmup = 2;
+        std::string      precision = "double";
+        int              threads = 0;       // 0: OpenMP default
+        std::string      cellKeys = "linear";
+        std::string      pairs = "default"; // full | half: neighbor lists of the symmetric pair loops
+        double           verletSkin = 0.0;  // PBF neighbor skin / kernel radius (0: rebuild every step)
+        std::string      out;               // empty: stdout only
+        bool             validate = false;
+        bool             pairKernels = false;
+
+        inline CellKeyMode cellKeyMode() const { return cellKeys == "linear" ? CellKeyMode::Linear : CellKeyMode::Morton; }
+    };
+
+    struct Stage
+    {
+        const char* name;
+        double      ms;
+    };
+
+    struct RunResult
+    {
+        std::string        solver;
+        std::string        precision;
+        int                particles = 0;
+        int                frames = 0;
+        int                steps = 0;
+        double             totalMs = 0.0;
+        std::vector<Stage> stages;
+        double             allocationsPerStep = 0.0;
+        double             neighborRebuildRate = 1.0;   // neighbor list builds per step
+
+        inline double particleStepsPerSecond() const
+        {
+            return totalMs > 0.0 ? double(particles) * double(steps) / (totalMs * 1e-3) : 0.0;
+        }
+    };
+
+    std::vector<int> parseList(const char* text)
+    {
+        std::vector<int> values;
+        std::stringstream stream(text);
+        std::string item;
+        while (std::getline(stream, item, ','))
+        {
+            values.push_back(std::atoi(item.c_str()));
+        }
+        return values;
+    }
+
+    bool parseOptions(int argc, char** argv, Options& options)
+    {
+        for (int k = 1; k < argc; ++k)
+        {
+            const bool has_value = k + 1 < argc;
+
+            if (std::strcmp(argv[k], "--solver") == 0 && has_value)          options.solver = argv[++k];
+            else if (std::strcmp(argv[k], "--particles") == 0 && has_value)  options.particles = parseList(argv[++k]);
+            else if (std::strcmp(argv[k], "--frames") == 0 && has_value)     options.frames = std::atoi(argv[++k]);
+            else if (std::strcmp(argv[k], "--warmup") == 0 && has_value)     options.warmup = std::atoi(argv[++k]);
+            else if (std::strcmp(argv[k], "--precision") == 0 && has_value)  options.precision = argv[++k];
+            else if (std::strcmp(argv[k], "--threads") == 0 && has_value)    options.threads = std::atoi(argv[++k]);
+            else if (std::strcmp(argv[k], "--out") == 0 && has_value)        options.out = argv[++k];
+            else if (std::strcmp(argv[k], "--cell-keys") == 0 && has_value)  options.cellKeys = argv[++k];
+            else if (std::strcmp(argv[k], "--pairs") == 0 && has_value)      options.pairs = argv[++k];
+            else if (std::strcmp(argv[k], "--verlet-skin") == 0 && has_value) options.verletSkin = std::atof(argv[++k]);
+            else if (std::strcmp(argv[k], "--validate") == 0)                options.validate = true;
+            else if (std::strcmp(argv[k], "--pair-kernels") == 0)            options.pairKernels = true;
+            else
+            {
+                fprintf(stderr, "Unknown or incomplete option: %s\n", argv[k]);
+                return false;
+            }
+        }
+
+        const bool valid_solver = options.solver == "pbf" || options.solver == "sph" || options.solver == "all";
+        const bool valid_precision = options.precision == "float" || options.precision == "double";
+        const bool valid_cell_keys = options.cellKeys == "linear" || options.cellKeys == "morton";
+        const bool valid_pairs = options.pairs == "default" || options.pairs == "full" || options.pairs == "half";
+        if (!valid_solver || !valid_precision || !valid_cell_keys || !valid_pairs || options.frames <= 0 || options.particles.empty() || options.verletSkin < 0.0)
+        {
+            fprintf(stderr, "Usage: %s [--solver pbf|sph|all] [--particles N,N,...] [--frames N] [--warmup N] "
+                            "[--precision float|double] [--threads N] [--out file.json] [--cell-keys linear|morton] "
+                            "[--pairs full|half] [--verlet-skin F] [--validate] [--pair-kernels]\n", argv[0]);
+            return false;
+        }
+        return true;
+    }
+
+    template <typename T>
+    RunResult runPBF(const int num_particles, const Options& options)
+    {
+        PBF_SystemT<T> system(num_particles);
+        system.setCellKeyMode(options.cellKeyMode());
+        if (options.pairs != "default")
+        {
+            system.setSymmetricPairs(options.pairs == "half");
+        }
+        system.setNeighborSkin(T(options.verletSkin) * system.getKernelRadius());
+
+        for (int frame = 0; frame < options.warmup; ++frame)
+        {
+            system.AnimationStep();
+        }
+        system.resetTimings();
+
+        const std::size_t allocations = alloc::count();
+        for (int frame = 0; frame < options.frames; ++frame)
+        {
+            system.AnimationStep();
+        }
+        const std::size_t timed_allocations = alloc::count() - allocations;  // before RunResult allocates
+
+        const PBF_StepTimings& t = system.getTimings();
+
+        RunResult result;
+        result.solver = "pbf";
+        result.precision = options.precision;
+        result.particles = system.getNumParticles();
+        result.frames = options.frames;
+        result.steps = t.steps;
+        result.totalMs = t.total();
+        result.stages = {
+            { "integrate", t.integrate },
+            { "neighbor_search", t.neighborSearch },
+            { "lambda", t.lambda },
+            { "delta_p", t.deltaP },
+            { "xsph", t.xsph },
+        };
+        result.allocationsPerStep = double(timed_allocations) / double(t.steps);
+        result.neighborRebuildRate = t.neighborRebuildRate();
+        return result;
+    }
+
+    RunResult runSPH(const int num_particles, const Options& options)
+    {
+        SPH_System system;
+        system.SetCellKeyMode(options.cellKeyMode());
+        if (options.pairs != "default")
+        {
+            system.SetSymmetricPairs(options.pairs == "half");
+        }
+        system.InitSystem(uint(num_particles));
+        system.sys_running = 1;
+
+        for (int frame = 0; frame < options.warmup; ++frame)
+        {
+            system.Animation();
+        }
+        system.ResetTimings();
+
+        const std::size_t allocations = alloc::count();
+        for (int frame = 0; frame < options.frames; ++frame)
+        {
+            system.Animation();
+        }
+        const std::size_t timed_allocations = alloc::count() - allocations;  // before RunResult allocates
+
+        const SPH_StepTimings& t = system.GetTimings();
+
+        RunResult result;
+        result.solver = "sph";
+        result.precision = "float";
+        result.particles = int(system.numParticles);
+        result.frames = options.frames;
+        result.steps = t.steps;
+        result.totalMs = t.total();
+        result.stages = {
+            { "emission", t.emission },
+            { "build_table", t.buildTable },
+            { "density_pressure", t.densPres },
+            { "force", t.forceAdv },
+            { "advection", t.advection },
+        };
+        result.allocationsPerStep = double(timed_allocations) / double(t.steps);
+        return result;
+    }
+
+    // SPH pair throughput: one particle against a full 3x3x3 cell neighborhood (the block
+    // SPH_System hands to the pair kernels), with the per-pair libm code SPH_System used
+    // before (pow in double, a branch per pair) and with SphPairKernels.h
+    struct PairKernelResult
+    {
+        bool   enabled = false;
+        int    candidates = 0;          // pairs per target particle
+        double libmDensity = 0.0;       // pairs per second
+        double packedDensity = 0.0;
+        double libmForce = 0.0;
+        double packedForce = 0.0;
+    };
+
+    float libmDensity(const SphPairCoefficients& c, const float* pos, const SphNeighborArrays& nb, const int n)
+    {
+        float dens = 0.0f;
+        for (int j = 0; j < n; ++j)
+        {
+            const float x = nb.p_x[j] - pos[0];
+            const float y = nb.p_y[j] - pos[1];
+            const float z = nb.p_z[j] - pos[2];
+            const float r2 = x * x + y * y + z * z;
+
+            if (r2 < INF || r2 >= c.h_squared)
+            {
+                continue;
+            }
+
+            dens = dens + pow(c.h_squared - r2, 3);
+        }
+        return dens;
+    }
+
+    SphForceSums libmForce(const SphPairCoefficients& c, const float* pos, const float* ev, const float pres,
+                           const SphNeighborArrays& nb, const int n)
+    {
+        SphForceSums sums;
+        for (int j = 0; j < n; ++j)
+        {
+            const float x = pos[0] - nb.p_x[j];
+            const float y = pos[1] - nb.p_y[j];
+            const float z = pos[2] - nb.p_z[j];
+            const float r2 = x * x + y * y + z * z;
+
+            if (r2 < c.h_squared && r2 > INF)
+            {
+                const float r = sqrt(r2);
+                const float V = nb.vol[j];
+                const float kernel_r = c.h - r;
+
+                float tempForce = V * (pres + nb.pres[j]) * c.spiky * kernel_r * kernel_r;
+                sums.acc_x -= x * tempForce / r;
+                sums.acc_y -= y * tempForce / r;
+                sums.acc_z -= z * tempForce / r;
+
+                tempForce = V * c.viscosity * c.visco * (c.h - r);
+                sums.acc_x += (nb.ev_x[j] - ev[0]) * tempForce;
+                sums.acc_y += (nb.ev_y[j] - ev[1]) * tempForce;
+                sums.acc_z += (nb.ev_z[j] - ev[2]) * tempForce;
+
+                const float temp = (-1) * c.grad_poly6 * V * pow(c.h_squared - r2, 2);
+                sums.grad_x += temp * x;
+                sums.grad_y += temp * y;
+                sums.grad_z += temp * z;
+                sums.lplc += c.lplc_poly6 * V * (c.h_squared - r2) * (r2 - 3 / 4 * (c.h_squared - r2));
+            }
+        }
+        return sums;
+    }
+
+    PairKernelResult runPairKernels(const Options& options)
+    {
+        // SPH_System's constants: h = 0.04, particles spawned every h / 2
+        const float h = 0.04f;
+        SphPairCoefficients c;
+        c.h = h;
+        c.h_squared = h * h;
+        c.spiky = float(-45.0 / (M_PI * std::pow(h, 6)));
+        c.visco = float(45.0 / (M_PI * std::pow(h, 6)));
+        c.grad_poly6 = float(-945.0 / (32.0 * M_PI * std::pow(h, 9)));
+        c.lplc_poly6 = float(-945.0 / (8.0 * M_PI * std::pow(h, 9)));
+        c.viscosity = 6.5f;
+
+        // 6x6x6 lattice over the cells [-1, 2)^3 (216 candidates), slightly jittered
+        std::vector<float> p_x, p_y, p_z, ev_x, ev_y, ev_z, vol, pres;
+        for (int k = 0; k < 216; ++k)
+        {
+            const float jitter = 0.05f * h * float((k * 7919) % 13) / 13.0f;
+            p_x.push_back((float(k % 6) - 2.0f) * 0.5f * h + 0.25f * h + jitter);
+            p_y.push_back((float(k / 6 % 6) - 2.0f) * 0.5f * h + 0.25f * h - jitter);
+            p_z.push_back((float(k / 36) - 2.0f) * 0.5f * h + 0.25f * h + 0.5f * jitter);
+            ev_x.push_back(0.01f * float(k % 5));
+            ev_y.push_back(-0.02f * float(k % 3));
+            ev_z.push_back(0.01f * float(k % 7));
+            vol.push_back(0.02f / 1000.0f / 2.0f);
+            pres.push_back(0.05f * float(k % 11));
+        }
+        const SphNeighborArrays nb = { p_x.data(), p_y.data(), p_z.data(), ev_x.data(), ev_y.data(), ev_z.data(),
+                                       vol.data(), pres.data() };
+        const int n = int(p_x.size());
+
+        // Targets: the 8 particles of the center cell, as in SPH_System
+        const int targets[8] = { 86, 87, 92, 93, 122, 123, 128, 129 };
+        const int repeats = 2000 * std::max(1, options.frames / 20);
+        const double pairs = double(repeats) * 8.0 * double(n);
+
+        PairKernelResult result;
+        result.enabled = true;
+        result.candidates = n;
+
+        float sink = 0.0f;
+        double libm_density_ms = 0.0, packed_density_ms = 0.0, libm_force_ms = 0.0, packed_force_ms = 0.0;
+        StageTimer timer;
+
+        for (int r = 0; r < repeats; ++r)
+            for (const int t : targets)
+            {
+                const float pos[3] = { p_x[t], p_y[t], p_z[t] };
+                sink += libmDensity(c, pos, nb, n);
+            }
+        timer.lap(libm_density_ms);
+
+        for (int r = 0; r < repeats; ++r)
+            for (const int t : targets)
+            {
+                const float pos[3] = { p_x[t], p_y[t], p_z[t] };
+                sink += sumDensityBatch(c, pos, nb, n);
+            }
+        timer.lap(packed_density_ms);
+
+        for (int r = 0; r < repeats; ++r)
+            for (const int t : targets)
+            {
+                const float pos[3] = { p_x[t], p_y[t], p_z[t] };
+                const float ev[3] = { ev_x[t], ev_y[t], ev_z[t] };
+                sink += libmForce(c, pos, ev, pres[t], nb, n).acc_x;
+            }
+        timer.lap(libm_force_ms);
+
+        for (int r = 0; r < repeats; ++r)
+            for (const int t : targets)
+            {
+                const float pos[3] = { p_x[t], p_y[t], p_z[t] };
+                const float ev[3] = { ev_x[t], ev_y[t], ev_z[t] };
+                sink += sumForceBatch(c, pos, ev, pres[t], nb, n).acc_x;
+            }
+        timer.lap(packed_force_ms);
+
+        // Keeps the loops from being optimized away
+        if (sink == 1234.5f)
+        {
+            fprintf(stderr, "%f\n", sink);
+        }
+
+        result.libmDensity = pairs / (libm_density_ms * 1e-3);
+        result.packedDensity = pairs / (packed_density_ms * 1e-3);
+        result.libmForce = pairs / (libm_force_ms * 1e-3);
+        result.packedForce = pairs / (packed_force_ms * 1e-3);
+        return result;
+    }
+
+    struct Validation
+    {
+        bool                  enabled = false;
+        PBF_PrecisionReport   precision;
+        PBF_DeterminismReport determinism;
+        SPH_StrayDensityReport strayDensity;
+        SPH_EmitterReport     emitter;
+        bool                  allocationsPassed = true;    // no run allocated after its warm-up
+
+        inline bool passed() const
+        {
+            return precision.passed && determinism.passed && strayDensity.passed && emitter.passed && allocationsPassed;
+        }
+    };
+
+    std::string toJson(const Options& options, const std::vector<RunResult>& results, const Validation& validation,
+                       const PairKernelResult& pairKernels)
+    {
+        std::ostringstream json;
+        json.setf(std::ios::fixed);
+        json.precision(4);
+
+        json << "{\n";
+        json << "  \"isa\": \"" << simd::isaName() << "\",\n";
+        json << "  \"threads\": " << omp_get_max_threads() << ",\n";
+        json << "  \"cell_keys\": \"" << options.cellKeys << "\",\n";
+        json << "  \"pairs\": \"" << options.pairs << "\",\n";
+        json << "  \"verlet_skin\": " << options.verletSkin << ",\n";
+        json << "  \"frames\": " << options.frames << ",\n";
+        json << "  \"warmup\": " << options.warmup << ",\n";
+        json << "  \"runs\": [\n";
+
+        for (std::size_t k = 0; k < results.size(); ++k)
+        {
+            const RunResult& r = results[k];
+
+            json << "    {\n";
+            json << "      \"solver\": \"" << r.solver << "\",\n";
+            json << "      \"precision\": \"" << r.precision << "\",\n";
+            json << "      \"particles\": " << r.particles << ",\n";
+            json << "      \"steps\": " << r.steps << ",\n";
+            json << "      \"total_ms\": " << r.totalMs << ",\n";
+            json << "      \"ms_per_step\": " << (r.steps > 0 ? r.totalMs / r.steps : 0.0) << ",\n";
+            json << "      \"stages_ms\": {";
+            for (std::size_t s = 0; s < r.stages.size(); ++s)
+            {
+                json << (s == 0 ? " " : ", ") << "\"" << r.stages[s].name << "\": " << r.stages[s].ms;
+            }
+            json << " },\n";
+            json << "      \"particle_steps_per_second\": " << r.particleStepsPerSecond() << ",\n";
+            json << "      \"allocations_per_step\": " << r.allocationsPerStep << ",\n";
+            json << "      \"neighbor_rebuild_rate\": " << r.neighborRebuildRate << "\n";
+            json << "    }" << (k + 1 < results.size() ? "," : "") << "\n";
+        }
+
+        json << "  ]";
+
+        if (validation.enabled)
+        {
+            const PBF_PrecisionFrame& last = validation.precision.frames.back();
+
+            json << ",\n  \"validation\": {\n";
+            json << "    \"precision_passed\": " << (validation.precision.passed ? "true" : "false") << ",\n";
+            json << "    \"center_of_mass_error\": " << std::scientific << last.centerOfMassError << ",\n";
+            json << "    \"rms_position_error\": " << last.rmsPositionError << std::fixed << ",\n";
+            json << "    \"determinism_passed\": " << (validation.determinism.passed ? "true" : "false") << ",\n";
+            json << "    \"determinism_mismatches\": " << validation.determinism.numMismatches << ",\n";
+            json << "    \"sph_stray_density_passed\": " << (validation.strayDensity.passed ? "true" : "false") << ",\n";
+            json << "    \"sph_emitter_passed\": " << (validation.emitter.passed ? "true" : "false") << ",\n";
+            json << "    \"sph_emitter_min_distance\": " << validation.emitter.minDistance << ",\n";
+            json << "    \"allocations_passed\": " << (validation.allocationsPassed ? "true" : "false") << "\n";
+            json << "  }";
+        }
+
+        if (pairKernels.enabled)
+        {
+            json << ",\n  \"sph_pair_kernels\": {\n";
+            json << "    \"candidates\": " << pairKernels.candidates << ",\n";
+            json << "    \"density_libm_pairs_per_second\": " << pairKernels.libmDensity << ",\n";
+            json << "    \"density_packed_pairs_per_second\": " << pairKernels.packedDensity << ",\n";
+            json << "    \"force_libm_pairs_per_second\": " << pairKernels.libmForce << ",\n";
+            json << "    \"force_packed_pairs_per_second\": " << pairKernels.packedForce << "\n";
+            json << "  }";
+        }
+
+        json << "\n}\n";
+        return json.str();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        return 1;
+    }
+
+    if (options.threads > 0)
+    {
+        omp_set_num_threads(options.threads);
+    }
+
+    std::vector<RunResult> results;
+    for (const int num_particles : options.particles)
+    {
+        if (options.solver == "pbf" || options.solver == "all")
+        {
+            results.push_back(options.precision == "float" ? runPBF<float>(num_particles, options)
+                                                           : runPBF<double>(num_particles, options));
+        }
+        if (options.solver == "sph" || options.solver == "all")
+        {
+            results.push_back(runSPH(num_particles, options));
+        }
+    }
+
+    Validation validation;
+    if (options.validate)
+    {
+        validation.enabled = true;
+        validation.precision = ComparePrecisions(options.frames, 1e-02);
+        validation.determinism = CheckThreadDeterminism(options.frames);
+        validation.strayDensity = CheckStrayDensity();
+        validation.emitter = CheckEmitterSpacing(20);
+        for (const RunResult& r : results)
+        {
+            validation.allocationsPassed = validation.allocationsPassed && r.allocationsPerStep == 0.0;
+        }
+    }
+
+    PairKernelResult pairKernels;
+    if (options.pairKernels)
+    {
+        pairKernels = runPairKernels(options);
+    }
+
+    const std::string json = toJson(options, results, validation, pairKernels);
+
+    if (!options.out.empty())
+    {
+        FILE* file = fopen(options.out.c_str(), "w");
+        if (file == NULL)
+        {
+            fprintf(stderr, "Cannot write %s\n", options.out.c_str());
+            return 1;
+        }
+        fputs(json.c_str(), file);
+        fclose(file);
+    }
+
+    fputs(json.c_str(), stdout);
+    return validation.enabled && !validation.passed() ? 1 : 0;
+}
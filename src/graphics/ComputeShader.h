@@ -36,6 +36,8 @@ public:
 
     void  use() const { glUseProgram(programID_); }
     void  dispatch(GLuint x, GLuint y = 1, GLuint z = 1) const { glDispatchCompute(x, y, z); }
+    // Group counts read by the GPU from the buffer bound to GL_DISPATCH_INDIRECT_BUFFER
+    void  dispatchIndirect(GLintptr offset = 0) const { glDispatchComputeIndirect(offset); }
 
     void setUniform(const std::string& name, int value);
     void setUniform(const std::string& name, GLuint value);
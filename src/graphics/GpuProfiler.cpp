@@ -0,0 +1,172 @@
+#include "GpuProfiler.h"
+
+#include <fstream>
+
+void GpuProfiler::init(int windowSize)
+{
+    destroy();
+
+    windowSize_ = windowSize > 0 ? windowSize : 1;
+    for (Frame& frame : frames_)
+    {
+        glGenQueries(static_cast<GLsizei>(frame.queries.size()), frame.queries.data());
+        frame.spans.reserve(kMaxSpans);
+    }
+    initialized_ = true;
+}
+
+void GpuProfiler::destroy()
+{
+    if (!initialized_)
+        return;
+
+    for (Frame& frame : frames_)
+    {
+        glDeleteQueries(static_cast<GLsizei>(frame.queries.size()), frame.queries.data());
+        frame.spans.clear();
+        frame.pending = false;
+    }
+    initialized_ = false;
+    recording_ = false;
+    openStage_ = -1;
+}
+
+int GpuProfiler::addStage(const std::string& name)
+{
+    Stage stage;
+    stage.name = name;
+    stages_.push_back(stage);
+    return static_cast<int>(stages_.size()) - 1;
+}
+
+void GpuProfiler::beginFrame()
+{
+    recording_ = false;
+    if (!enabled_ || !initialized_)
+        return;
+
+    collect();
+
+    // Slot still waiting for the GPU: skip this frame instead of waiting
+    const int next = (current_ + 1) % kNumFrames;
+    if (frames_[next].pending)
+        return;
+
+    current_ = next;
+    frames_[current_].spans.clear();
+    recording_ = true;
+}
+
+void GpuProfiler::begin(int stage)
+{
+    Frame& frame = frames_[current_];
+    if (!recording_ || frame.spans.size() == kMaxSpans)
+        return;
+
+    const GLuint first = static_cast<GLuint>(2 * frame.spans.size());
+    glQueryCounter(frame.queries[first], GL_TIMESTAMP);
+    frame.spans.push_back(Span{ stage, first });
+    openStage_ = stage;
+}
+
+void GpuProfiler::end()
+{
+    if (openStage_ < 0)
+        return;
+
+    const Frame& frame = frames_[current_];
+    glQueryCounter(frame.queries[frame.spans.back().first + 1], GL_TIMESTAMP);
+    openStage_ = -1;
+}
+
+void GpuProfiler::endFrame()
+{
+    if (!recording_)
+        return;
+
+    frames_[current_].pending = !frames_[current_].spans.empty();
+    recording_ = false;
+
+    collect();
+}
+
+void GpuProfiler::collect()
+{
+    // Oldest slot first; timestamps complete in order, so stop at the first unfinished frame
+    for (int k = 1; k <= kNumFrames; ++k)
+    {
+        Frame& frame = frames_[(current_ + k) % kNumFrames];
+        if (!frame.pending)
+            continue;
+
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(frame.queries[frame.spans.back().first + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available == GL_FALSE)
+            break;
+
+        for (Stage& stage : stages_)
+            stage.last_ms = 0.0;
+
+        for (const Span& span : frame.spans)
+        {
+            GLuint64 t0 = 0, t1 = 0;
+            glGetQueryObjectui64v(frame.queries[span.first], GL_QUERY_RESULT, &t0);
+            glGetQueryObjectui64v(frame.queries[span.first + 1], GL_QUERY_RESULT, &t1);
+            stages_[span.stage].last_ms += (t1 - t0) * 1e-6;
+        }
+        frame.pending = false;
+        ++numFramesRead_;
+
+        for (Stage& stage : stages_)
+            stage.window_ms += stage.last_ms;
+
+        if (++windowFrames_ == windowSize_)
+        {
+            avgTotal_ms_ = 0.0;
+            for (Stage& stage : stages_)
+            {
+                stage.avg_ms = stage.window_ms / windowSize_;
+                stage.window_ms = 0.0;
+                avgTotal_ms_ += stage.avg_ms;
+            }
+            windowFrames_ = 0;
+        }
+    }
+}
+
+bool GpuProfiler::writeCSV(const std::string& path) const
+{
+    std::ofstream out(path);
+    if (!out)
+        return false;
+
+    out.setf(std::ios::fixed);
+    out.precision(4);
+
+    out << "stage,avg_ms,last_ms\n";
+    for (const Stage& stage : stages_)
+        out << stage.name << ',' << stage.avg_ms << ',' << stage.last_ms << '\n';
+    out << "total," << avgTotal_ms_ << ",\n";
+    return static_cast<bool>(out);
+}
+
+bool GpuProfiler::writeJSON(const std::string& path) const
+{
+    std::ofstream out(path);
+    if (!out)
+        return false;
+
+    out.setf(std::ios::fixed);
+    out.precision(4);
+
+    out << "{\n";
+    out << "  \"window_frames\": " << windowSize_ << ",\n";
+    out << "  \"frames_read\": " << numFramesRead_ << ",\n";
+    out << "  \"total_avg_ms\": " << avgTotal_ms_ << ",\n";
+    out << "  \"stages_ms\": {";
+    for (size_t s = 0; s < stages_.size(); ++s)
+        out << (s == 0 ? " " : ", ") << "\"" << stages_[s].name << "\": " << stages_[s].avg_ms;
+    out << " }\n";
+    out << "}\n";
+    return static_cast<bool>(out);
+}
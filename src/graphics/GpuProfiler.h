@@ -0,0 +1,89 @@
+// GpuProfiler.h
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+
+// GPU stage timings from GL_TIMESTAMP queries.
+//
+// Each frame records begin()/end() pairs around the dispatches of a stage (a stage can
+// be timed several times per frame, e.g. once per substep; the spans are summed). Query
+// sets live in a ring of kNumFrames: a frame is only read back once its last query is
+// available, so the profiler never waits for the GPU, and a frame whose ring slot is
+// still in flight is simply not profiled. Results are averaged over windowSize frames.
+class GpuProfiler
+{
+public:
+    static constexpr int kNumFrames = 4;
+    static constexpr int kMaxSpans = 256;       // begin/end pairs per frame
+
+    struct Stage
+    {
+        std::string name;
+        double avg_ms = 0.0;                    // mean per frame over the last full window
+        double last_ms = 0.0;                   // last frame read back
+        double window_ms = 0.0;                 // sum over the current window
+    };
+
+    GpuProfiler() noexcept = default;
+    ~GpuProfiler() { destroy(); }
+
+    GpuProfiler(const GpuProfiler&) = delete;
+    GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+    void init(int windowSize = 60);
+    void destroy();
+
+    // Stage ids are indices into stages(); register them once, before the first frame
+    int addStage(const std::string& name);
+
+    void beginFrame();
+    void begin(int stage);
+    void end();
+    void endFrame();
+
+    inline void setEnabled(bool enabled) { enabled_ = enabled; }
+    inline bool isEnabled() const { return enabled_; }
+
+    inline const std::vector<Stage>& stages() const { return stages_; }
+    inline double avgTotal_ms() const { return avgTotal_ms_; }
+    inline uint64_t numFramesRead() const { return numFramesRead_; }
+    inline int windowSize() const { return windowSize_; }
+
+    // Averages of the last window, one row / entry per stage (false if the file can't be opened)
+    bool writeCSV(const std::string& path) const;
+    bool writeJSON(const std::string& path) const;
+
+private:
+    struct Span
+    {
+        int stage;
+        GLuint first;                           // query index of begin(); end() is first + 1
+    };
+
+    struct Frame
+    {
+        std::array<GLuint, 2 * kMaxSpans> queries{};
+        std::vector<Span> spans;
+        bool pending = false;
+    };
+
+    void collect();
+
+    std::array<Frame, kNumFrames> frames_{};
+    int current_ = 0;
+    bool recording_ = false;                    // the current frame got a free ring slot
+    int openStage_ = -1;
+
+    std::vector<Stage> stages_;
+    int windowSize_ = 60;
+    int windowFrames_ = 0;
+    double avgTotal_ms_ = 0.0;
+    uint64_t numFramesRead_ = 0;
+
+    bool enabled_ = true;
+    bool initialized_ = false;
+};
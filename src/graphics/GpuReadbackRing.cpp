@@ -0,0 +1,97 @@
+#include "GpuReadbackRing.h"
+
+void GpuReadbackRing::init(GLsizeiptr slotSize)
+{
+    destroy();
+
+    slotSize_ = slotSize;
+
+    const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glCreateBuffers(1, &buffer_);
+    glNamedBufferStorage(buffer_, slotSize_ * kNumFrames, nullptr, flags);
+    mapped_ = static_cast<const uint8_t*>(glMapNamedBufferRange(buffer_, 0, slotSize_ * kNumFrames, flags));
+}
+
+void GpuReadbackRing::destroy()
+{
+    reset();
+
+    if (buffer_ != 0)
+        glDeleteBuffers(1, &buffer_);      // also unmaps it
+
+    buffer_ = 0;
+    mapped_ = nullptr;
+    slotSize_ = 0;
+}
+
+bool GpuReadbackRing::capture(GLuint srcBuffer, GLintptr srcOffset, GLsizeiptr size, uint64_t frameId)
+{
+    if (buffer_ == 0 || size > slotSize_ || numQueued_ == kNumFrames)
+    {
+        ++numDropped_;
+        return false;
+    }
+
+    Slot& slot = slots_[(head_ + numQueued_) % kNumFrames];
+
+    // Shader writes to srcBuffer must land before the copy reads it
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glCopyNamedBufferSubData(srcBuffer, buffer_, srcOffset, slotSize_ * (&slot - slots_.data()), size);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.size = size;
+    slot.frameId = frameId;
+    ++numQueued_;
+
+    // Without a flush the fence might never reach the GPU if nobody else submits work
+    glFlush();
+    return true;
+}
+
+const void* GpuReadbackRing::acquire(uint64_t* frameId, GLsizeiptr* size)
+{
+    if (numQueued_ == 0)
+        return nullptr;
+
+    Slot& slot = slots_[head_];
+    if (!acquired_)
+    {
+        // Timeout 0: only asks whether the copy is done
+        const GLenum status = glClientWaitSync(slot.fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+            return nullptr;
+
+        acquired_ = true;
+    }
+
+    if (frameId) *frameId = slot.frameId;
+    if (size)    *size = slot.size;
+    return mapped_ + slotSize_ * head_;
+}
+
+void GpuReadbackRing::release()
+{
+    if (!acquired_)
+        return;
+
+    glDeleteSync(slots_[head_].fence);
+    slots_[head_] = Slot();
+
+    head_ = (head_ + 1) % kNumFrames;
+    --numQueued_;
+    acquired_ = false;
+}
+
+void GpuReadbackRing::reset()
+{
+    for (Slot& slot : slots_)
+    {
+        if (slot.fence != nullptr)
+            glDeleteSync(slot.fence);
+        slot = Slot();
+    }
+
+    head_ = 0;
+    numQueued_ = 0;
+    acquired_ = false;
+}
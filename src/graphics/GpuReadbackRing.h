@@ -0,0 +1,70 @@
+// GpuReadbackRing.h
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <glad/glad.h>
+
+// Non-blocking GPU -> CPU readback through a ring of persistently mapped slots.
+//
+// capture() queues a copy of a buffer range into the next free slot and fences it;
+// acquire() hands back the oldest capture whose fence has signalled, as a pointer into
+// the mapped memory that stays valid until release(). Neither call waits for the GPU:
+// with kNumFrames = 3 the CPU reads the state of two frames ago while the GPU keeps
+// working, and a capture is dropped (capture() returns false) when every slot is still
+// queued or held by the reader, instead of stalling the simulation.
+class GpuReadbackRing
+{
+public:
+    static constexpr int kNumFrames = 3;
+
+    GpuReadbackRing() noexcept = default;
+    ~GpuReadbackRing() { destroy(); }
+
+    GpuReadbackRing(const GpuReadbackRing&) = delete;
+    GpuReadbackRing& operator=(const GpuReadbackRing&) = delete;
+
+    // Allocates kNumFrames slots of slotSize bytes (needs a current GL 4.5 context)
+    void init(GLsizeiptr slotSize);
+    void destroy();
+
+    // Queues a copy of [srcOffset, srcOffset + size) of srcBuffer, tagged with frameId.
+    // Includes the barrier that makes earlier shader writes visible to the copy.
+    bool capture(GLuint srcBuffer, GLintptr srcOffset, GLsizeiptr size, uint64_t frameId);
+    inline bool capture(GLuint srcBuffer, uint64_t frameId) { return capture(srcBuffer, 0, slotSize_, frameId); }
+
+    // Oldest finished capture (nullptr if none is ready yet); call release() when done with it
+    const void* acquire(uint64_t* frameId = nullptr, GLsizeiptr* size = nullptr);
+    void release();
+
+    template <typename T>
+    const T* acquireAs(uint64_t* frameId = nullptr, GLsizeiptr* size = nullptr)
+    {
+        return static_cast<const T*>(acquire(frameId, size));
+    }
+
+    // Drops every queued capture (e.g. after the source buffers were recreated)
+    void reset();
+
+    inline bool isPending() const { return numQueued_ > 0; }
+    inline GLsizeiptr slotSize() const { return slotSize_; }
+    inline uint64_t numDropped() const { return numDropped_; }
+
+private:
+    struct Slot
+    {
+        GLsync     fence = nullptr;
+        GLsizeiptr size = 0;
+        uint64_t   frameId = 0;
+    };
+
+    GLuint buffer_ = 0;
+    const uint8_t* mapped_ = nullptr;
+    GLsizeiptr slotSize_ = 0;
+
+    std::array<Slot, kNumFrames> slots_{};
+    int head_ = 0;              // oldest queued capture
+    int numQueued_ = 0;         // queued captures, including the acquired one
+    bool acquired_ = false;     // slots_[head_] is held by the reader
+    uint64_t numDropped_ = 0;
+};
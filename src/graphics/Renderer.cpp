@@ -197,6 +197,7 @@ void Renderer::Run()
         m_AppInfo.vramSampleIdx = (m_AppInfo.vramSampleIdx + 1) % m_AppInfo.vramSamples.size();
 
         m_ImGuiLayer.ShowInfoPanel(m_AppInfo);
+        m_ImGuiLayer.ShowGpuTimingsPanel(m_PBFGPU_System.GetProfiler(), m_PBFGPU_System.GetCpuUpdateGridMs());
         m_Camera.SetFOV(m_AppInfo.fov);
 
         glClearColor(0.278f, 0.278f, 0.278f, 1.0f);
@@ -1,22 +1,30 @@
 # Leer y concatenar el contenido de dos archivos
 $contenido = Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\IntegrateAndPredict.comp" -Raw
 $contenido += "`n`n"
-$contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\AssignCells.comp" -Raw
+$contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\ComputeBounds.comp" -Raw
+$contenido += "`n`n"
+$contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\UpdateGridParams.comp" -Raw
 $contenido += "`n`n"
-$contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\Sort_ExtractBit.comp" -Raw
+$contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\AssignCells.comp" -Raw
 $contenido += "`n`n"
-$contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\Sort_BlockScan.comp" -Raw
+$contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\Sort_DigitHistogram.comp" -Raw
 $contenido += "`n`n"
-$contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\Sort_AddOffset.comp" -Raw
+$contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\Sort_ScanSums.comp" -Raw
 $contenido += "`n`n"
-$contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\Sort_Reorder.comp" -Raw
+$contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\Sort_DigitScatter.comp" -Raw
 $contenido += "`n`n"
 $contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\FindCellBounds.comp" -Raw
 $contenido += "`n`n"
+$contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\BuildCellList.comp" -Raw
+$contenido += "`n`n"
 $contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\ComputeLambda.comp" -Raw
 $contenido += "`n`n"
+$contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\ComputeLambda_Tiled.comp" -Raw
+$contenido += "`n`n"
 $contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\ComputeDeltaP.comp" -Raw
 $contenido += "`n`n"
+$contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\ComputeDeltaP_Tiled.comp" -Raw
+$contenido += "`n`n"
 $contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\ApplyDeltaP.comp" -Raw
 $contenido += "`n`n"
 $contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\UpdateVelocity.comp" -Raw
@@ -25,6 +33,8 @@ $contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\grap
 $contenido += "`n`n"
 $contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\ApplyViscosity.comp" -Raw
 $contenido += "`n`n"
+$contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\ApplyViscosity_Tiled.comp" -Raw
+$contenido += "`n`n"
 $contenido += Get-Content "C:\Users\Javie\VSCode Projects\TFM\SPH-Fluid\src\graphics\compute\ResolveCollisions.comp" -Raw
 
 
@@ -1,11 +1,30 @@
 // main.cpp
 #include "./graphics/Renderer.h"
 #include "./physics/PBF_System.h"
+#include "./physics/PBF_Validation.h"
 
-int main()
+#include <cstring>
+
+int main(int argc, char** argv)
 {
     //PBF_System system = PBF_System();
 
+    // Headless check of the CPU solver in float against double
+    if (argc > 1 && std::strcmp(argv[1], "--validate-precision") == 0)
+    {
+        const PBF_PrecisionReport report = ComparePrecisions(60, 1e-02);
+        PrintPrecisionReport(report);
+        return report.passed ? 0 : 1;
+    }
+
+    // Headless check that the CPU solver gives the same answer for any thread count
+    if (argc > 1 && std::strcmp(argv[1], "--validate-determinism") == 0)
+    {
+        const PBF_DeterminismReport report = CheckThreadDeterminism(10);
+        PrintDeterminismReport(report);
+        return report.passed ? 0 : 1;
+    }
+
     Renderer app(1280, 720, "PBF-Fluid");
     
     //app.TestComputeShader();
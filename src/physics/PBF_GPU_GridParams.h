@@ -0,0 +1,21 @@
+// PBF_GPU_GridParams.h
+#pragma once
+
+#include <glad/glad.h>
+
+// Grid of the current step, computed on the GPU (ComputeBounds.comp + UpdateGridParams.comp)
+// and read by AssignCells and the neighbor kernels from SSBO 16.
+// This struct mirrors the std430 layout in the GLSL compute shaders.
+struct PBF_GPU_GridParams
+{
+    GLuint  minBits[4];       // AABB of the positions, as order-preserving uints (xyz)
+    GLuint  maxBits[4];
+    GLfloat origin[4];        // xyz
+    GLint   resolution[4];    // xyz
+    GLuint  keyMode;          // CellKeyMode actually used this step
+    GLuint  tableSize;        // Hashed: number of buckets (power of two)
+    GLuint  numKeys;          // keys used this step (<= cell buffer capacity)
+    GLuint  requiredKeys;     // keys the requested mode needs; the CPU grows the cell buffers from it
+};
+
+static_assert(sizeof(PBF_GPU_GridParams) == 80, "PBF_GPU_GridParams must match the GLSL std430 layout");
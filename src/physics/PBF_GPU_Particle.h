@@ -12,7 +12,7 @@ struct PBF_GPU_Particle
     EIGEN_ALIGN16 Eigen::Vector4f v;      // Velocity (xyz), w unused
     EIGEN_ALIGN16 Eigen::Vector4f p;      // Predicted position (xyz), w unused
     EIGEN_ALIGN16 Eigen::Vector4f color;  // RGBA color
-    EIGEN_ALIGN16 Eigen::Vector4f meta;   // x: mass, y: index, z/w: optional (density, flags, etc.)
+    EIGEN_ALIGN16 Eigen::Vector4f meta;   // x: mass, y: stable ID (kept across reorders), z/w: optional (density, flags, etc.)
 };
 
 /// GLSL Version:
@@ -18,8 +18,6 @@ PBF_GPU_System::~PBF_GPU_System()
     del(ssboParticles);
     del(ssboCellKey);
     del(ssboParticleIdx);
-    del(ssboBits);
-    del(ssboScan);
     del(ssboSums);
     del(ssboOffsets);
     del(ssboKeysTmp);
@@ -29,7 +27,18 @@ PBF_GPU_System::~PBF_GPU_System()
     del(ssboLambda);
     del(ssboDeltaP);
     del(ssboDensity);
-    del(ssboDeltaV);
+    del(ssboVelSnapshot);
+    del(ssboParticlesTmp);
+    del(ssboGridParams);
+    del(ssboTileCells);
+    del(ssboTileDispatch);
+    del(ssboVerletState);
+    del(ssboVerletRef);
+
+    gridParamsReadback.destroy();
+    particleReadback.destroy();
+    verletReadback.destroy();
+    profiler.destroy();
 }
 
 void PBF_GPU_System::Init()
@@ -39,6 +48,7 @@ void PBF_GPU_System::Init()
     InitSSBOs();
     InitComputeShaders();
     InitSimulation();
+    InitProfiler();
     
     //UpdateGrid();
 }
@@ -52,8 +62,6 @@ void PBF_GPU_System::InitParticles()
     std::cout << "numParticles: " << numParticles << std::endl;
     std::cout << "Mass: " << massPerParticle << std::endl;
 
-    GLuint k = 0;
-
     for (int i = 0; i < numParticles; ++i)
     {
         float mirrorX = 1.f, mirrorZ = 1.f;
@@ -87,7 +95,7 @@ void PBF_GPU_System::InitParticles()
         }
         P.color = color;
 
-        P.meta << massPerParticle, float(k), 0, 0;
+        P.meta << massPerParticle, float(i), 0, 0;      // y: stable ID
     }
 }
 
@@ -148,61 +156,122 @@ void PBF_GPU_System::InitSimulation()
 
     glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
+    // The relaxation steps do not count for the rebuild rate
+    const GLuint resetCounters[2] = { 0, 0 };
+    glNamedBufferSubData(ssboVerletState, offsetof(PBF_GPU_VerletState, numChecks), sizeof(resetCounters), resetCounters);
+    verletReadback.reset();
 }
 
 void PBF_GPU_System::UpdateGrid()
 {
-    // 1. Leer posiciones de la GPU (o mantén una copia CPU si ya la tienes)
-    std::vector<PBF_GPU_Particle> cpuBuffer(numParticles);
-    glGetNamedBufferSubData(ssboParticles, 0,
-        sizeof(PBF_GPU_Particle) * numParticles,
-        cpuBuffer.data());
+    // 1. Buffers de celdas: se ajustan con el resultado de un paso anterior (sin esperar a la GPU)
+    CheckCellCapacity();
 
-    Eigen::Vector3f minPos(FLT_MAX, FLT_MAX, FLT_MAX);
-    Eigen::Vector3f maxPos(-FLT_MAX, -FLT_MAX, -FLT_MAX);
-    for (const auto& p : cpuBuffer)
+    // 2. Listas de Verlet: la GPU decide si este subpaso reconstruye las celdas
+    if (verletSkin > 0.0f)
+        CheckVerletSkin();
+
+    // 3. AABB en la GPU (la tabla hash no lo necesita)
+    if (cellKeyMode != CellKeyMode::Hashed)
     {
-        minPos = minPos.cwiseMin(p.x.head<3>());
-        maxPos = maxPos.cwiseMax(p.x.head<3>());
+        const GLuint reset[8] = { UINT_MAX, UINT_MAX, UINT_MAX, UINT_MAX, 0, 0, 0, 0 };   // minBits, maxBits
+        glNamedBufferSubData(ssboGridParams, 0, sizeof(reset), reset);
+
+        computeBounds.use();
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboParticles);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16, ssboGridParams);
+        DispatchRebuildPass(computeBounds, numWorkGroups, VerletParticleGroups);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
     }
 
-    // 2. Margen = h para que las vecinas quepan
-    float pad = cellSize;
-    Eigen::Vector3f origin = minPos - Eigen::Vector3f::Ones() * pad;
-    Eigen::Vector3f extent = (maxPos - minPos) + 2.0f * Eigen::Vector3f::Ones() * pad;
+    // 4. Origen, resolución y modo de clave -> ssboGridParams (lo leen AssignCells y los kernels de vecinos)
+    updateGridParams.use();
+    updateGridParams.setUniform("uRequestedMode", static_cast<GLuint>(cellKeyMode));
+    updateGridParams.setUniform("uCapacity", currentTotCells);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16, ssboGridParams);
+    DispatchRebuildPass(updateGridParams, 1, VerletSingleGroup);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
-    // 3. Nº celdas (ceil) + 1
-    Eigen::Array3i res = ((extent / cellSize).array()).ceil().cast<int>() + 1;
-    gridRes = res;
-    GLuint totCells = gridRes.prod();
+    // 5. Copia para un CheckCellCapacity posterior (si el anillo está lleno se descarta)
+    gridParamsReadback.capture(ssboGridParams, substepCount);
+}
 
-    // 4. Asegura que los buffers tienen tamaño suficiente
-    if (totCells > currentTotCells)
+void PBF_GPU_System::CheckCellCapacity()
+{
+    // Si la copia aún no ha terminado se mira en el siguiente paso
+    const PBF_GPU_GridParams* params = gridParamsReadback.acquireAs<PBF_GPU_GridParams>();
+    if (params == nullptr)
+        return;
+
+    const GLuint required = params->requiredKeys;
+    gridParamsReadback.release();
+
+    // Histéresis: crecer con un 50 % de margen, encoger sólo si sobran 3/4 partes.
+    // Mientras la rejilla no cabe, UpdateGridParams usa la tabla hash sobre los buffers actuales.
+    const bool grow = required > currentTotCells && currentTotCells < maxCellKeys;
+    const bool shrink = required < currentTotCells / 4 && currentTotCells > hashTableSize;
+    if (grow || shrink)
     {
-        ResizeCellBuffers(totCells);
-        currentTotCells = totCells;
+        const GLuint64 wanted = GLuint64(required) + required / 2;
+        const GLuint newTotCells = static_cast<GLuint>(std::clamp<GLuint64>(wanted, hashTableSize, maxCellKeys));
+        ResizeCellBuffers(newTotCells);
+        currentTotCells = newTotCells;
     }
+}
 
-    gridOrigin = origin;
+void PBF_GPU_System::CheckVerletSkin()
+{
+    // 1. Desplazamiento máximo desde la última reconstrucción
+    verletCheck.use();
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboParticles);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 19, ssboVerletState);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20, ssboVerletRef);
+    verletCheck.dispatch(numWorkGroups);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
-    // 5. Sube uniforms a TODOS los kernels implicados
-    auto pushGrid = [&](ComputeShader& cs)
-        {
-            cs.use();
-            cs.setUniform("uGridOrigin", gridOrigin);
-            cs.setUniform("uGridResolution", gridRes);
-            cs.setUniform("uCellSize", cellSize);
-        };
+    // 2. Decisión -> argumentos indirectos de las pasadas de reconstrucción
+    verletDecide.use();
+    verletDecide.setUniform("uForceRebuild", static_cast<GLuint>(verletForceRebuild ? 1 : 0));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 19, ssboVerletState);
+    verletDecide.dispatch(1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+    verletForceRebuild = false;
+}
+
+void PBF_GPU_System::DispatchRebuildPass(const ComputeShader& shader, GLuint numGroups, VerletCommand command)
+{
+    if (verletSkin <= 0.0f)
+    {
+        shader.dispatch(numGroups);
+        return;
+    }
 
-    pushGrid(assign);
-    pushGrid(computeLambda);
-    pushGrid(computeDeltaP);
-    pushGrid(computeDensity);
-    pushGrid(applyViscosity);
+    // Group count written by VerletDecide.comp (zero while the lists are still valid);
+    // the tiled kernels read their own indirect buffer
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, ssboVerletState);
+    shader.dispatchIndirect(offsetof(PBF_GPU_VerletState, dispatch) + sizeof(GLuint) * 3 * command);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, ssboTileDispatch);
+}
+
+void PBF_GPU_System::PollVerletState()
+{
+    // Counters of a couple of frames ago (never waits for the GPU)
+    if (const PBF_GPU_VerletState* state = verletReadback.acquireAs<PBF_GPU_VerletState>())
+    {
+        if (state->numChecks > 0)
+            neighborRebuildRate = double(state->numRebuilds) / double(state->numChecks);
+        verletReadback.release();
+    }
+    verletReadback.capture(ssboVerletState, frameCount);
 }
 
 void PBF_GPU_System::InitSSBOs()
 {
+    // Cell buffers start at the hash table size; CheckCellCapacity resizes them for the dense grids
+    const GLuint totCells = hashTableSize;
+    currentTotCells = totCells;
+
     // [0] - SSBO Particles
     glCreateBuffers(1, &ssboParticles);
     glNamedBufferData(  ssboParticles, 
@@ -230,35 +299,19 @@ void PBF_GPU_System::InitSSBOs()
                         GL_DYNAMIC_DRAW);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ssboParticleIdx);
 
-    // ### - Radix-sort (split-scan, 32 bits)
-    // [3] - Bits
-    glCreateBuffers(1, &ssboBits);
-    glNamedBufferData(  ssboBits,
-                        sizeof(GLuint) * numParticles,
-                        nullptr,
-                        GL_DYNAMIC_DRAW);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboBits);
-
-    // [4] - Scan
-    glCreateBuffers(1, &ssboScan);
-    glNamedBufferData(  ssboScan,
-                        sizeof(GLuint) * numParticles,
-                        nullptr,
-                        GL_DYNAMIC_DRAW);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssboScan);
-
-    // [5] - Sums
+    // ### - Radix-sort (8-bit digits, histogram + scan + scatter)
+    // [5] - Sums (digit histogram of every tile)
     glCreateBuffers(1, &ssboSums);
     glNamedBufferData(  ssboSums,
-                        sizeof(GLuint) * numWorkGroups,
+                        sizeof(GLuint) * sortRadix * numSortTiles,
                         nullptr,
                         GL_DYNAMIC_DRAW);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, ssboSums);
 
-    // [6] - Offsets
+    // [6] - Offsets (+1: the last entry holds the total, written by Sort_ScanSums)
     glCreateBuffers(1, &ssboOffsets);
     glNamedBufferData(  ssboOffsets,
-                        sizeof(GLuint) * numWorkGroups,
+                        sizeof(GLuint) * (sortRadix * numSortTiles + 1),
                         nullptr,
                         GL_DYNAMIC_DRAW);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, ssboOffsets);
@@ -321,13 +374,75 @@ void PBF_GPU_System::InitSSBOs()
                         GL_DYNAMIC_DRAW);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, ssboDensity);
 
-    // [14] – DeltaV
-    glCreateBuffers(1, &ssboDeltaV);
-    glNamedBufferData(  ssboDeltaV,
+    // [14] – Velocity snapshot (XSPH)
+    glCreateBuffers(1, &ssboVelSnapshot);
+    glNamedBufferData(  ssboVelSnapshot,
                         sizeof(Eigen::Vector4f)* numParticles,
                         nullptr, 
                         GL_DYNAMIC_DRAW);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, ssboDeltaV);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, ssboVelSnapshot);
+
+    // [15] - ParticlesTmp (reorder target)
+    glCreateBuffers(1, &ssboParticlesTmp);
+    glNamedBufferData(  ssboParticlesTmp,
+                        sizeof(PBF_GPU_Particle) * numParticles,
+                        nullptr,
+                        GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, ssboParticlesTmp);
+
+    // [16] - GridParams (zero: no grid until the first UpdateGrid)
+    const PBF_GPU_GridParams initParams{};
+    glCreateBuffers(1, &ssboGridParams);
+    glNamedBufferData(  ssboGridParams,
+                        sizeof(PBF_GPU_GridParams),
+                        &initParams,
+                        GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16, ssboGridParams);
+
+    // [17] - TileCells (one entry per non-empty cell at most)
+    glCreateBuffers(1, &ssboTileCells);
+    glNamedBufferData(  ssboTileCells,
+                        sizeof(GLuint) * numParticles,
+                        nullptr,
+                        GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 17, ssboTileCells);
+
+    // [18] - TileDispatch (also the GL_DISPATCH_INDIRECT_BUFFER of the tiled kernels)
+    const GLuint initDispatch[3] = { 0, 1, 1 };
+    glCreateBuffers(1, &ssboTileDispatch);
+    glNamedBufferData(  ssboTileDispatch,
+                        sizeof(initDispatch),
+                        initDispatch,
+                        GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 18, ssboTileDispatch);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, ssboTileDispatch);
+
+    // [19] - VerletState (y = z = 1 in every command; VerletDecide only writes x)
+    PBF_GPU_VerletState initVerlet{};
+    for (auto& command : initVerlet.dispatch)
+    {
+        command[1] = 1;
+        command[2] = 1;
+    }
+    glCreateBuffers(1, &ssboVerletState);
+    glNamedBufferData(  ssboVerletState,
+                        sizeof(PBF_GPU_VerletState),
+                        &initVerlet,
+                        GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 19, ssboVerletState);
+
+    // [20] - VerletRef (written by the first rebuild, which is always forced)
+    glCreateBuffers(1, &ssboVerletRef);
+    glNamedBufferData(  ssboVerletRef,
+                        sizeof(Eigen::Vector4f) * numParticles,
+                        nullptr,
+                        GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20, ssboVerletRef);
+
+    // Readbacks (persistently mapped rings, see GpuReadbackRing)
+    gridParamsReadback.init(sizeof(PBF_GPU_GridParams));
+    particleReadback.init(sizeof(PBF_GPU_Particle) * numParticles);
+    verletReadback.init(sizeof(PBF_GPU_VerletState));
 }
 
 void PBF_GPU_System::InitComputeShaders()
@@ -338,40 +453,70 @@ void PBF_GPU_System::InitComputeShaders()
     integrate.setUniform("uDeltaTime", (float)timeStep);
     integrate.setUniform("uGravity", gravity);
 
+    // 2) Grid (AABB + params, see UpdateGrid)
+    computeBounds = ComputeShader("..\\src\\graphics\\compute\\ComputeBounds.comp");
+    computeBounds.use();
+    computeBounds.setUniform("uNumParticles", numParticles);
+
+    updateGridParams = ComputeShader("..\\src\\graphics\\compute\\UpdateGridParams.comp");
+    updateGridParams.use();
+    updateGridParams.setUniform("uCellSize", cellSize);
+    updateGridParams.setUniform("uHashTableSize", hashTableSize);
+
     // 2) Assign Cell
     assign = ComputeShader("..\\src\\graphics\\compute\\AssignCells.comp");
     assign.use();
-    assign.setUniform("uGridOrigin", gridOrigin);
-    assign.setUniform("uGridResolution", gridRes);
     assign.setUniform("uCellSize", cellSize);
+    assign.setUniform("uNumParticles", numParticles);
 
-    // 3) Radix Short
-    // a) ExtractBit
-    rsExtract = ComputeShader("..\\src\\graphics\\compute\\Sort_ExtractBit.comp");
-    rsExtract.use();
-    rsExtract.setUniform("uNumElements", numParticles);
-
-    // b)
+    // 2-b) Verlet lists (only dispatched with verletSkin > 0)
+    verletCheck = ComputeShader("..\\src\\graphics\\compute\\VerletCheck.comp");
+    verletCheck.use();
+    verletCheck.setUniform("uNumParticles", numParticles);
 
-    rsScan = ComputeShader("..\\src\\graphics\\compute\\Sort_BlockScan.comp");
-    rsScan.use();
-    rsScan.setUniform("uNumElements", numParticles);
+    verletDecide = ComputeShader("..\\src\\graphics\\compute\\VerletDecide.comp");
+    verletDecide.use();
+    verletDecide.setUniform("uHalfSkin", 0.5f * verletSkin);
+    verletDecide.setUniform("uNumWorkGroups", numWorkGroups);
+    verletDecide.setUniform("uNumSortTiles", numSortTiles);
 
-    // c)
-    rsAddOffset = ComputeShader("..\\src\\graphics\\compute\\Sort_AddOffset.comp");
-    rsAddOffset.use();
-    rsAddOffset.setUniform("uNumElements", numParticles);
+    verletBeginRebuild = ComputeShader("..\\src\\graphics\\compute\\VerletBeginRebuild.comp");
+    verletBeginRebuild.use();
+    verletBeginRebuild.setUniform("uNumParticles", numParticles);
 
-    // d)
-    rsReorder = ComputeShader("..\\src\\graphics\\compute\\Sort_Reorder.comp");
-    rsReorder.use();
-    rsReorder.setUniform("uNumElements", numParticles);
+    // 3) Radix Short
+    // a) Digit histogram per tile
+    rsHistogram = ComputeShader("..\\src\\graphics\\compute\\Sort_DigitHistogram.comp");
+    rsHistogram.use();
+    rsHistogram.setUniform("uNumElements", numParticles);
+    rsHistogram.setUniform("uNumTiles", numSortTiles);
+
+    // b) Exclusive scan of the histograms (one work-group, no CPU round trip)
+    rsScanSums = ComputeShader("..\\src\\graphics\\compute\\Sort_ScanSums.comp");
+    rsScanSums.use();
+    rsScanSums.setUniform("uNumGroups", sortRadix * numSortTiles);
+
+    // c) Stable scatter
+    rsScatter = ComputeShader("..\\src\\graphics\\compute\\Sort_DigitScatter.comp");
+    rsScatter.use();
+    rsScatter.setUniform("uNumElements", numParticles);
+    rsScatter.setUniform("uNumTiles", numSortTiles);
 
     // 4) Find-Cell-Bounds
     findBounds = ComputeShader("..\\src\\graphics\\compute\\FindCellBounds.comp");
     findBounds.use();
     findBounds.setUniform("uNumElements", numParticles);
 
+    // 4-b) Reorder particles into cell order
+    reorderParticles = ComputeShader("..\\src\\graphics\\compute\\ReorderParticles.comp");
+    reorderParticles.use();
+    reorderParticles.setUniform("uNumParticles", numParticles);
+
+    buildCellList = ComputeShader("..\\src\\graphics\\compute\\BuildCellList.comp");
+    buildCellList.use();
+    buildCellList.setUniform("uNumElements", numParticles);
+    buildCellList.setUniform("uMinTileParticles", minTileParticles);
+
     // 5) PBF
     // 5.a - Compute Lambdas
     computeLambda = ComputeShader("..\\src\\graphics\\compute\\ComputeLambda.comp");
@@ -380,7 +525,15 @@ void PBF_GPU_System::InitComputeShaders()
     computeLambda.setUniform("uRestDensity", (float)restDensity);
     computeLambda.setUniform("uRadius", (float)radius);
     computeLambda.setUniform("uEpsilon", (float)epsilon);
-    computeLambda.setUniform("uGridResolution", gridRes);
+    computeLambda.setUniform("uCellSize", cellSize);
+    computeLambda.setUniform("uMinTileParticles", minTileParticles);
+
+    computeLambdaTiled = ComputeShader("..\\src\\graphics\\compute\\ComputeLambda_Tiled.comp");
+    computeLambdaTiled.use();
+    computeLambdaTiled.setUniform("uRestDensity", (float)restDensity);
+    computeLambdaTiled.setUniform("uRadius", (float)radius);
+    computeLambdaTiled.setUniform("uEpsilon", (float)epsilon);
+    computeLambdaTiled.setUniform("uCellSize", cellSize);
 
     // 5.b - Compute DeltaPs
     computeDeltaP = ComputeShader("..\\src\\graphics\\compute\\ComputeDeltaP.comp");
@@ -390,7 +543,16 @@ void PBF_GPU_System::InitComputeShaders()
     computeDeltaP.setUniform("uRestDensity", (float)restDensity);
     computeDeltaP.setUniform("uSCorrK", (float)massPerParticle * 1e-4f);
     computeDeltaP.setUniform("uSCorrN", 4.0f);
-    computeDeltaP.setUniform("uGridResolution", gridRes);
+    computeDeltaP.setUniform("uCellSize", cellSize);
+    computeDeltaP.setUniform("uMinTileParticles", minTileParticles);
+
+    computeDeltaPTiled = ComputeShader("..\\src\\graphics\\compute\\ComputeDeltaP_Tiled.comp");
+    computeDeltaPTiled.use();
+    computeDeltaPTiled.setUniform("uRadius", (float)radius);
+    computeDeltaPTiled.setUniform("uRestDensity", (float)restDensity);
+    computeDeltaPTiled.setUniform("uSCorrK", (float)massPerParticle * 1e-4f);
+    computeDeltaPTiled.setUniform("uSCorrN", 4.0f);
+    computeDeltaPTiled.setUniform("uCellSize", cellSize);
 
     // 5.c - Apply DeltaPs
     applyDeltaP = ComputeShader("..\\src\\graphics\\compute\\ApplyDeltaP.comp");
@@ -402,6 +564,7 @@ void PBF_GPU_System::InitComputeShaders()
     updateVelocity.use();
     updateVelocity.setUniform("uDeltaTime", (float)timeStep);
     updateVelocity.setUniform("uDamping", (float)damping);
+    updateVelocity.setUniform("uNumParticles", numParticles);
 
     // 7-a  Density for XSPH
     computeDensity = ComputeShader("..\\src\\graphics\\compute\\ComputeDensity.comp");
@@ -409,8 +572,6 @@ void PBF_GPU_System::InitComputeShaders()
     computeDensity.setUniform("uNumParticles", numParticles);
     computeDensity.setUniform("uMass", (float)massPerParticle);
     computeDensity.setUniform("uRadius", (float)radius);
-    computeDensity.setUniform("uGridOrigin", gridOrigin);
-    computeDensity.setUniform("uGridResolution", gridRes);
     computeDensity.setUniform("uCellSize", cellSize);
     computeDensity.setUniform("INT_MAX", initStart);
 
@@ -421,10 +582,16 @@ void PBF_GPU_System::InitComputeShaders()
     applyViscosity.setUniform("uMass", (float)massPerParticle);
     applyViscosity.setUniform("uRadius", (float)radius);
     applyViscosity.setUniform("uViscosity", (float)viscosity);
-    applyViscosity.setUniform("uGridOrigin", gridOrigin);
-    applyViscosity.setUniform("uGridResolution", gridRes);
     applyViscosity.setUniform("uCellSize", cellSize);
     applyViscosity.setUniform("INT_MAX", initStart);
+    applyViscosity.setUniform("uMinTileParticles", minTileParticles);
+
+    applyViscosityTiled = ComputeShader("..\\src\\graphics\\compute\\ApplyViscosity_Tiled.comp");
+    applyViscosityTiled.use();
+    applyViscosityTiled.setUniform("uMass", (float)massPerParticle);
+    applyViscosityTiled.setUniform("uRadius", (float)radius);
+    applyViscosityTiled.setUniform("uViscosity", (float)viscosity);
+    applyViscosityTiled.setUniform("uCellSize", cellSize);
 
     // 8) ?
 
@@ -454,123 +621,108 @@ void PBF_GPU_System::Step()
 {
     //UpdateGrid();
 
+    profiler.beginFrame();
+    cpuUpdateGrid_ms = 0.0;
+
     for (int i = 0; i < numSubSteps; i++)
     {
         Step(subTimeStep);
     }
+
+    profiler.endFrame();
+    UpdateTimings();
+
+    if (captureParticles)
+        particleReadback.capture(ssboParticles, frameCount);
+    if (verletSkin > 0.0f)
+        PollVerletState();
+    ++frameCount;
 }
 
 void PBF_GPU_System::Step(float dt)
 {
-    UpdateGrid();
-
     // 1) Integrate
+    profiler.begin(StageIntegrate);
     integrate.use();
     integrate.setUniform("uDeltaTime", dt);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboParticles);
     integrate.dispatch(numWorkGroups);
-    //glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-    
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    profiler.end();
+
+    // 1-b) Grid (bounds of the predicted positions that AssignCells keys) and, with a Verlet skin,
+    //      the check of the predicted positions that decides whether the cells are rebuilt.
+    //      Every rebuild pass below goes through DispatchRebuildPass.
+    StageTimer timer;
+    profiler.begin(StageUpdateGrid);
+    UpdateGrid();
+    profiler.end();
+    timer.lap(cpuUpdateGrid_ms);
+
     // 2) Hash
+    profiler.begin(StageHash);
+    if (verletSkin > 0.0f)
+    {
+        // Empties the cells of the previous sort (instead of the clears in 4) and stores the
+        // reference positions; reads the old keys, so it goes before AssignCells
+        verletBeginRebuild.use();
+        verletBeginRebuild.setUniform("uCapacity", currentTotCells);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboParticles);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssboCellKey);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, ssboCellStart);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, ssboCellEnd);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20, ssboVerletRef);
+        DispatchRebuildPass(verletBeginRebuild, numWorkGroups, VerletParticleGroups);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
     assign.use();
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboParticles);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssboCellKey);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ssboParticleIdx);
-    assign.dispatch(numWorkGroups);
+    DispatchRebuildPass(assign, numWorkGroups, VerletParticleGroups);
     glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-
-    // 3) Radix Short
-    #pragma omp parallel for
-    for (GLuint bit = 0; bit < 32; ++bit)
+    profiler.end();
+
+    // 3) Radix Short - only the digits that the current grid can produce
+    //    (3 dispatches per 8-bit digit; passes depend on each other and GL calls must stay on this thread)
+    profiler.begin(StageRadixSort);
+    const GLuint maxKey = currentTotCells - 1;      // keys never reach the cell buffer capacity
+    GLuint keyBits = 1;
+    while (keyBits < 32 && (maxKey >> keyBits) != 0)
+        ++keyBits;
+
+    // Verlet: a substep without rebuild dispatches zero groups but the handles below are still
+    // swapped, so the sort takes an even number of passes (a pass over a zero digit keeps the
+    // order) and the sorted keys end up in ssboCellKey either way
+    if (verletSkin > 0.0f)
+        keyBits = std::min<GLuint>(32, (keyBits + 2 * sortDigitBits - 1) / (2 * sortDigitBits) * (2 * sortDigitBits));
+
+    for (GLuint shift = 0; shift < keyBits; shift += sortDigitBits)
     {
-        // a) Extract bit
-        rsExtract.use();
-        rsExtract.setUniform("uBit", bit);
-        rsExtract.setUniform("uNumElements", numParticles);
+        // a) Histogram of the digit in every tile
+        rsHistogram.use();
+        rsHistogram.setUniform("uShift", shift);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssboCellKey);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboBits);
-        rsExtract.dispatch(numWorkGroups);
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-
-        // b) BlockScan
-        rsScan.use();
-        rsScan.setUniform("uNumElements", numParticles);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboBits);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssboScan);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, ssboSums);
-        rsScan.dispatch(numWorkGroups);
+        DispatchRebuildPass(rsHistogram, numSortTiles, VerletSortTiles);
         glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
-        // c) prefixScan - in CPU
-        std::vector<GLuint> sums(numWorkGroups), offs(numWorkGroups);
-        glGetNamedBufferSubData(    ssboSums, 
-                                    0, 
-                                    sizeof(GLuint) * numWorkGroups,
-                                    sums.data());
-        GLuint numOnes = 0;
-        for (GLuint g = 0; g < numWorkGroups; ++g)
-        { 
-            offs[g] = numOnes;
-            numOnes += sums[g];
-                
-        }
-        glNamedBufferSubData(   ssboOffsets, 
-                                0,
-                                sizeof(GLuint) * numWorkGroups,
-                                offs.data());;
-        
-        // d) addOffset
-        rsAddOffset.use();
-        rsAddOffset.setUniform("uNumElements", numParticles);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssboScan);
+        // b) ScanSums - global offset of every (digit, tile)
+        rsScanSums.use();
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, ssboSums);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, ssboOffsets);
-        rsAddOffset.dispatch(numWorkGroups);
+        DispatchRebuildPass(rsScanSums, 1, VerletSingleGroup);
         glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
-#ifdef DEBUG
-        if (verbose)
-        {
-            int n = 32;
-            std::vector<GLuint> bits(n), scan(n);
-            glGetNamedBufferSubData(ssboBits, 0, n * sizeof(GLuint), bits.data());
-            glGetNamedBufferSubData(ssboScan, 0, n * sizeof(GLuint), scan.data());
-            std::cout << "Bit [" << bit << "]\n";
-            std::cout << "bits : \t"; for (auto b : bits)  std::cout << b << ' '; std::cout << '\n';
-            std::cout << "scan : \t"; for (auto s : scan)  std::cout << s << ' '; std::cout << '\n';
-        }
-        else
-        {
-            const GLuint Ncheck = 8 * 1024;
-            std::vector<GLuint> bitsCPU(Ncheck), scanGPU(Ncheck);
-
-            glGetNamedBufferSubData(ssboBits, 0, Ncheck * sizeof(GLuint), bitsCPU.data());
-            glGetNamedBufferSubData(ssboScan, 0, Ncheck * sizeof(GLuint), scanGPU.data());
-
-            bool ok = true;
-            GLuint prefix = 0;
-            for (GLuint i = 0; i < Ncheck && ok; ++i)
-            {
-                if (scanGPU[i] != prefix)              ok = false;
-                prefix += bitsCPU[i];
-            }
-            if (ok && prefix != scanGPU.back() + bitsCPU.back()) ok = false;   // último valor
-
-            std::cout << "[CHECK bit " << bit << "] scan " << (ok ? "OK\n"
-                : "ERROR: mismatch in prefix-scan\n");
-        }
-#endif // DEBUG
-
-        // e) Reorder
-        rsReorder.use();
-        rsReorder.setUniform("uNumElements", numParticles);
-        rsReorder.setUniform("uTotalFalses", numParticles - numOnes);
+        // c) Scatter
+        rsScatter.use();
+        rsScatter.setUniform("uShift", shift);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssboCellKey);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ssboParticleIdx);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboBits);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssboScan);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, ssboOffsets);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, ssboKeysTmp);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, ssboValsTmp);
-        rsReorder.dispatch(numWorkGroups);
+        DispatchRebuildPass(rsScatter, numSortTiles, VerletSortTiles);
         glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
         std::swap(ssboCellKey, ssboKeysTmp);
@@ -581,6 +733,7 @@ void PBF_GPU_System::Step(float dt)
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, ssboKeysTmp);      // Keys temporales
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, ssboValsTmp);      // Vals temporales
     }
+    profiler.end();
 #ifdef DEBUG
     // Checking Radix Short
     if (verbose)
@@ -589,7 +742,7 @@ void PBF_GPU_System::Step(float dt)
         std::vector<GLuint> sortedKeys(kPrint), sortedIdx(kPrint);
         glGetNamedBufferSubData(ssboCellKey, 0, sizeof(GLuint) * kPrint, sortedKeys.data());
         glGetNamedBufferSubData(ssboParticleIdx, 0, sizeof(GLuint) * kPrint, sortedIdx.data());
-        const GLuint C = gridRes * gridRes * gridRes;
+        const GLuint C = currentTotCells;
 
         std::cout << "\n--- Resultado etapa 3: Radix Sort (primeros " << kPrint << ") ---\n";
         for (GLuint i = 0; i < kPrint; ++i)
@@ -605,7 +758,7 @@ void PBF_GPU_System::Step(float dt)
             numParticles * sizeof(GLuint), k.data());
 
         bool sorted = std::is_sorted(k.begin(), k.end());
-        bool withinRange = *std::max_element(k.begin(), k.end()) < gridRes * gridRes * gridRes;
+        bool withinRange = *std::max_element(k.begin(), k.end()) < currentTotCells;
 
         std::cout << "[CHECK radix sort] "
             << (sorted ? "sorted" : "NOT sorted") << " | "
@@ -614,30 +767,68 @@ void PBF_GPU_System::Step(float dt)
 #endif // DEBUG
 
     // 4) Find-Cell-Bounds
+    profiler.begin(StageFindCellBounds);
     findBounds.use();
-    glClearNamedBufferData( ssboCellStart, 
-                            GL_R32I,
-                            GL_RED_INTEGER,
-                            GL_INT,
-                            &initStart);
-    glClearNamedBufferData( ssboCellEnd,    
-                            GL_R32I,
-                            GL_RED_INTEGER,
-                            GL_INT,
-                            &initEnd);
-
-    findBounds.dispatch(numWorkGroups);
+    if (verletSkin <= 0.0f)     // Verlet: VerletBeginRebuild already emptied the old cells
+    {
+        glClearNamedBufferData( ssboCellStart, 
+                                GL_R32I,
+                                GL_RED_INTEGER,
+                                GL_INT,
+                                &initStart);
+        glClearNamedBufferData( ssboCellEnd,    
+                                GL_R32I,
+                                GL_RED_INTEGER,
+                                GL_INT,
+                                &initEnd);
+    }
+
+    DispatchRebuildPass(findBounds, numWorkGroups, VerletParticleGroups);
 
     glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT);
 
+    // 4-b) Reorder - every few substeps the particles are moved to their sorted slot, so the
+    //      neighbor loops (P[idx[p]]) read contiguous memory. In between the order only drifts
+    //      a little and idx keeps pointing at the right particle.
+    if (reorderInterval > 0 && substepCount % reorderInterval == 0)
+    {
+        reorderParticles.use();
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboParticles);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ssboParticleIdx);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, ssboParticlesTmp);
+        reorderParticles.dispatch(numWorkGroups);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        std::swap(ssboParticles, ssboParticlesTmp);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboParticles);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, ssboParticlesTmp);
+    }
+    ++substepCount;
+
+    // 4-c) Dense cells for the tiled kernels (one work group per cell, indirect dispatch);
+    //      the per-particle kernels skip their particles
+    if (minTileParticles > 0)
+    {
+        const GLuint resetDispatch[3] = { 0, 1, 1 };
+        glNamedBufferSubData(ssboTileDispatch, 0, sizeof(resetDispatch), resetDispatch);
+
+        buildCellList.use();
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssboCellKey);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, ssboCellStart);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, ssboCellEnd);
+        buildCellList.dispatch(numWorkGroups);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+    }
+    profiler.end();
+
 #ifdef DEBUG
-    std::vector<int> start(totCells), end(totCells);
-    glGetNamedBufferSubData(ssboCellStart, 0, totCells * sizeof(int), start.data());
-    glGetNamedBufferSubData(ssboCellEnd, 0, totCells * sizeof(int), end.data());
+    std::vector<int> start(currentTotCells), end(currentTotCells);
+    glGetNamedBufferSubData(ssboCellStart, 0, currentTotCells * sizeof(int), start.data());
+    glGetNamedBufferSubData(ssboCellEnd, 0, currentTotCells * sizeof(int), end.data());
     if (verbose)
     {
         std::cout << "\n--- Cell bounds ---\n";
-        for (GLuint c = 0; c < totCells; ++c)
+        for (GLuint c = 0; c < currentTotCells; ++c)
             if (start[c] != INT_MAX)
                 std::cout << "cell " << c << " : [" << start[c] << ", " << end[c] << ")\n";
     }
@@ -646,7 +837,7 @@ void PBF_GPU_System::Step(float dt)
         bool allOk = true;
         int prevEnd = 0, total = 0;
 
-        for (GLuint c = 0; c < totCells; ++c)
+        for (GLuint c = 0; c < currentTotCells; ++c)
         {
             int s = start[c], e = end[c];
             if (s == INT_MAX && e == -1) continue;   // celda vacía ― nada que comprobar
@@ -667,6 +858,7 @@ void PBF_GPU_System::Step(float dt)
 #endif // DEBUG 
 
     // 5) PBF Steps
+    profiler.begin(StagePBF);
 
     for (int it = 0; it < numIter; ++it)
     {
@@ -679,8 +871,14 @@ void PBF_GPU_System::Step(float dt)
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, ssboCellStart);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, ssboCellEnd);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, ssboLambda);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, ssboDensity);
 
         computeLambda.dispatch(numWorkGroups);
+        if (minTileParticles > 0)
+        {
+            computeLambdaTiled.use();      // writes other particles: no barrier in between
+            computeLambdaTiled.dispatchIndirect();
+        }
         glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
     
 #ifdef DEBUG
@@ -704,6 +902,11 @@ void PBF_GPU_System::Step(float dt)
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, ssboDeltaP);
 
         computeDeltaP.dispatch(numWorkGroups);
+        if (minTileParticles > 0)
+        {
+            computeDeltaPTiled.use();
+            computeDeltaPTiled.dispatchIndirect();
+        }
         glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
 #ifdef DEBUG  
@@ -741,6 +944,7 @@ void PBF_GPU_System::Step(float dt)
         applyDeltaP.dispatch(numWorkGroups);
         glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
     }
+    profiler.end();
 #ifdef DEBUG 
     // Copy Post Values
     std::vector<PBF_GPU_Particle> after(numParticles);
@@ -780,24 +984,33 @@ void PBF_GPU_System::Step(float dt)
 
 
     // 6 Update Velocity
+    profiler.begin(StageUpdateVelocity);
     updateVelocity.use();
     updateVelocity.setUniform("uDeltaTime", dt);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboParticles);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, ssboVelSnapshot);
     updateVelocity.dispatch(numWorkGroups);
     glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    profiler.end();
 
-    // 7-a) Compute densities for XSPH
-    computeDensity.use();
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboParticles);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssboCellKey);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ssboParticleIdx);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, ssboCellStart);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, ssboCellEnd);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, ssboDensity);
-    computeDensity.dispatch(numWorkGroups);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    // 7-a) Densities for XSPH: by default the last ComputeLambda already left them in ssboDensity
+    if (!reuseLambdaDensity)
+    {
+        profiler.begin(StageXSPH);
+        computeDensity.use();
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboParticles);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssboCellKey);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ssboParticleIdx);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, ssboCellStart);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, ssboCellEnd);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, ssboDensity);
+        computeDensity.dispatch(numWorkGroups);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        profiler.end();
+    }
 
-    // 7-b) Apply viscosity
+    // 7-b) Apply viscosity (single neighbor sweep)
+    profiler.begin(StageViscosity);
     applyViscosity.use();
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboParticles);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssboCellKey);
@@ -805,17 +1018,25 @@ void PBF_GPU_System::Step(float dt)
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, ssboCellStart);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, ssboCellEnd);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, ssboDensity);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, ssboDeltaV);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, ssboVelSnapshot);
     applyViscosity.dispatch(numWorkGroups);
+    if (minTileParticles > 0)
+    {
+        applyViscosityTiled.use();
+        applyViscosityTiled.dispatchIndirect();
+    }
     glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    profiler.end();
 
     // 8 ?
 
     // 9) Collisions
+    profiler.begin(StageCollisions);
     resolveCollisions.use();
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboParticles);
     resolveCollisions.dispatch(numWorkGroups);
     //glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    profiler.end();
 
     //PrintTimes();
 }
@@ -829,6 +1050,33 @@ void PBF_GPU_System::Test(int n)
     }
 }
 
+void PBF_GPU_System::ReadParticlesByID(std::vector<PBF_GPU_Particle>& out) const
+{
+    std::vector<PBF_GPU_Particle> slots(numParticles);
+    glGetNamedBufferSubData(ssboParticles, 0,
+        sizeof(PBF_GPU_Particle) * numParticles,
+        slots.data());
+
+    out.resize(numParticles);
+    for (const auto& p : slots)
+        out[static_cast<GLuint>(p.meta.y())] = p;
+}
+
+bool PBF_GPU_System::PollParticles(std::vector<PBF_GPU_Particle>& out, uint64_t* frame)
+{
+    const PBF_GPU_Particle* slots = particleReadback.acquireAs<PBF_GPU_Particle>(frame);
+    if (slots == nullptr)
+        return false;
+
+    // Straight from the mapped memory, already in ID order
+    out.resize(numParticles);
+    for (GLuint s = 0; s < numParticles; ++s)
+        out[static_cast<GLuint>(slots[s].meta.y())] = slots[s];
+
+    particleReadback.release();
+    return true;
+}
+
 void PBF_GPU_System::ResizeCellBuffers(GLuint newTotCells)
 {
     // Libera los SSBO antiguos
@@ -852,6 +1100,41 @@ void PBF_GPU_System::ResizeCellBuffers(GLuint newTotCells)
         initEnd.data(),
         GL_DYNAMIC_DRAW);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, ssboCellEnd);
+
+    // The new buffers are empty: the next substep has to rebuild its cell lists
+    verletForceRebuild = true;
+}
+
+void PBF_GPU_System::InitProfiler()
+{
+    // Same order as ProfileStage
+    profiler.init(profileWindow);
+    profiler.addStage("UpdateGrid");
+    profiler.addStage("Integrate");
+    profiler.addStage("Hash");
+    profiler.addStage("RadixSort");
+    profiler.addStage("FindCellBounds");
+    profiler.addStage("PBF");
+    profiler.addStage("UpdateVelocity");
+    profiler.addStage("XSPH");
+    profiler.addStage("Viscosity");
+    profiler.addStage("Collisions");
+}
+
+void PBF_GPU_System::UpdateTimings()
+{
+    // Window averages of the profiler (they only change once per window)
+    const auto& stages = profiler.stages();
+    gpuUpdateGrid_ms = stages[StageUpdateGrid].avg_ms;
+    gpuIntegrate_ms = stages[StageIntegrate].avg_ms;
+    gpuHash_ms = stages[StageHash].avg_ms;
+    gpuRadixShort_ms = stages[StageRadixSort].avg_ms;
+    gpuFindCellBounds_ms = stages[StageFindCellBounds].avg_ms;
+    gpuPBF_ms = stages[StagePBF].avg_ms;
+    gpuUpdateVelocity_ms = stages[StageUpdateVelocity].avg_ms;
+    gpuXSPH_ms = stages[StageXSPH].avg_ms;
+    gpuViscosity_ms = stages[StageViscosity].avg_ms;
+    gpuCollisions_ms = stages[StageCollisions].avg_ms;
 }
 
 void PBF_GPU_System::PrintTimes() const
@@ -875,6 +1158,7 @@ void PBF_GPU_System::PrintTimes() const
         };
 
     print("CPU UpdateGrid", cpuUpdateGrid_ms);
+    print("GPU UpdateGrid", gpuUpdateGrid_ms);
     print("GPU Integrate", gpuIntegrate_ms);
     print("GPU Hash", gpuHash_ms);
     print("GPU RadixSort", gpuRadixShort_ms);
@@ -885,17 +1169,15 @@ void PBF_GPU_System::PrintTimes() const
     print("GPU Viscosity", gpuViscosity_ms);
     print("GPU Collisions", gpuCollisions_ms);
 
-    //--- total GPU -----------------------------------------------------------------
-    const double gpuTotal = std::accumulate(
-        std::begin({ gpuIntegrate_ms, gpuHash_ms, gpuRadixShort_ms,
-                    gpuFindCellBounds_ms, gpuPBF_ms, gpuUpdateVelocity_ms,
-                    gpuXSPH_ms, gpuViscosity_ms, gpuCollisions_ms }),
-        std::end({ gpuIntegrate_ms, gpuHash_ms, gpuRadixShort_ms,
-                  gpuFindCellBounds_ms, gpuPBF_ms, gpuUpdateVelocity_ms,
-                  gpuXSPH_ms, gpuViscosity_ms, gpuCollisions_ms }),
-        0.0);
+    //--- total GPU: suma de las medias de todas las etapas del perfilador ---------
+    const double gpuTotal = profiler.avgTotal_ms();
 
     cout << sep;
     print("GPU TOTAL", gpuTotal);
+    cout << sep;
+
+    // Ratio, no tiempo: subpasos que reconstruyeron las celdas / subpasos (1 sin skin de Verlet)
+    cout << setw(wLabel) << "Neighbor rebuild rate" << ": "
+        << fixed << setprecision(3) << neighborRebuildRate << " rebuilds/substep\n";
     cout << sep << std::endl;
 }
\ No newline at end of file
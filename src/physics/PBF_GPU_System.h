@@ -9,7 +9,13 @@
 #include <omp.h>
 
 #include "PBF_GPU_Particle.h"
+#include "PBF_GPU_GridParams.h"
+#include "PBF_GPU_VerletState.h"
 #include "../graphics/ComputeShader.h"
+#include "../graphics/GpuReadbackRing.h"
+#include "../graphics/GpuProfiler.h"
+#include "../support/Timer.h"
+#include "maths/CellKey.h"
 
 //#define DEBUG
 //#define AABB
@@ -25,6 +31,9 @@ private:
 	const int numIter = 2;
 	const float timeStep = 1.0f / 140.0f;
 	const float subTimeStep = timeStep / numSubSteps;
+	const int reorderInterval = 4;		// substeps between particle reorders into cell order (0 = never)
+	const GLuint minTileParticles = 12;		// cells with this many particles run the *_Tiled kernels (0 = per-particle only)
+	const bool reuseLambdaDensity = true;	// XSPH reads the densities of the last ComputeLambda (false: ComputeDensity pass)
 	const double radius = 0.1;
 	const double restDensity = 1000.0;
 	const double epsilon = 1e05;
@@ -34,14 +43,25 @@ private:
 	//const double totalMass = 1081.0;
 	const double massPerParticle = totalMass / numParticles;
 	const Eigen::Vector3f gravity = Eigen::Vector3f(0.f, -9.81f, 0.f);
-	Eigen::Vector3f gridOrigin = Eigen::Vector3f( 0.f, 5.f, 0.f);
 	
 	// Kernels Consts
 	const GLuint workGroup = 128;
 	const GLuint numWorkGroups = (numParticles + workGroup - 1) / workGroup;
-	Eigen::Array3i gridRes = Eigen::Array3i(600,80,600);
-	GLuint totCells = gridRes.prod();
-	const float cellSize = 0.1f;
+	// Hashed cell table: buckets proportional to the particle count, not to the domain volume
+	const GLuint hashTableSize = NextPowerOfTwo(2 * numParticles);
+	// Radix sort: 8-bit digits, 1024 keys per tile (Sort_Digit*.comp)
+	const GLuint sortRadix = 256;
+	const GLuint sortDigitBits = 8;
+	const GLuint sortTileSize = 1024;
+	const GLuint numSortTiles = (numParticles + sortTileSize - 1) / sortTileSize;
+	// Verlet lists: cells of h + skin, re-sorted only once a particle has moved more than
+	// skin / 2 since the last sort (0 = re-sort every substep); the rebuild rate is in PrintTimes
+	const float verletSkin = 0.0f;
+	const float cellSize = float(radius) + verletSkin;
+	CellKeyMode cellKeyMode = CellKeyMode::Hashed;				// requested layout (A/B with Linear / Morton)
+	// Grid origin/resolution live on the GPU (ssboGridParams); the CPU only sizes the cell buffers
+	GLuint currentTotCells = 0;									// capacity of cellStart / cellEnd, in keys
+	const GLuint maxCellKeys = 1u << 26;						// larger grids stay on the hash table
 #ifdef AABB
 	const Eigen::Vector3f MinBound = Eigen::Vector3f(-2.f, 0.0f, -2.f);
 	const Eigen::Vector3f MaxBound = Eigen::Vector3f( 2.f, 30.0f, 2.f);
@@ -58,10 +78,8 @@ private:
 	GLuint ssboCellKey;			//  1
 	GLuint ssboParticleIdx;		//  2
 		// -- Radix Short
-	GLuint ssboBits;			//  3
-	GLuint ssboScan;			//  4
-	GLuint ssboSums;			//  5
-	GLuint ssboOffsets;			//  6
+	GLuint ssboSums;			//  5	digit histograms [digit * numSortTiles + tile]
+	GLuint ssboOffsets;			//  6	their exclusive scan (+ total)
 	GLuint ssboKeysTmp;			//  7
 	GLuint ssboValsTmp;			//  8
 	GLuint ssboCellStart;		//  9
@@ -69,22 +87,45 @@ private:
 	GLuint ssboLambda;			// 11
 	GLuint ssboDeltaP;			// 12
 	GLuint ssboDensity;			// 13
-	GLuint ssboDeltaV;			// 14
+	GLuint ssboVelSnapshot;		// 14	velocities after UpdateVelocity, read by XSPH
+	GLuint ssboParticlesTmp;	// 15	reorder target, swapped with ssboParticles
+	GLuint ssboGridParams;		// 16	PBF_GPU_GridParams of the current step
+	GLuint ssboTileCells;		// 17	keys of the cells handled by the tiled kernels
+	GLuint ssboTileDispatch;	// 18	indirect dispatch args of the tiled kernels (x = number of cells)
+	GLuint ssboVerletState;		// 19	PBF_GPU_VerletState (also the indirect args of the rebuild passes)
+	GLuint ssboVerletRef;		// 20	predicted positions at the last rebuild, by stable ID
+
+	// Non-blocking readbacks (see GpuReadbackRing): the CPU sees them a couple of steps late
+	GpuReadbackRing gridParamsReadback;		// cell buffer capacity check
+	GpuReadbackRing particleReadback;		// particle states for export / recording
+	GpuReadbackRing verletReadback;			// rebuild counters
+	bool captureParticles = false;
+	uint64_t frameCount = 0;
 
 	// Compute Shaders
 	ComputeShader integrate;
 
 	ComputeShader assign;
 
-	ComputeShader rsExtract;
-	ComputeShader rsScan;
-	ComputeShader rsAddOffset;
-	ComputeShader rsReorder;
+	ComputeShader rsHistogram;
+	ComputeShader rsScanSums;
+	ComputeShader rsScatter;
+
+	ComputeShader computeBounds;
+	ComputeShader updateGridParams;
+
+	ComputeShader verletCheck;
+	ComputeShader verletDecide;
+	ComputeShader verletBeginRebuild;
 
 	ComputeShader findBounds;
+	ComputeShader reorderParticles;
+	ComputeShader buildCellList;
 
 	ComputeShader computeLambda;
+	ComputeShader computeLambdaTiled;
 	ComputeShader computeDeltaP;
+	ComputeShader computeDeltaPTiled;
 	ComputeShader applyDeltaP;
 	
 	ComputeShader updateVelocity;
@@ -92,24 +133,47 @@ private:
 
 	ComputeShader computeDensity;
 	ComputeShader applyViscosity;
+	ComputeShader applyViscosityTiled;
 
 	ComputeShader resetVelocity;
 
 	const int initStart = INT_MAX;   //  0x7FFFFFFF
 	const int initEnd = -1;
 
+	int substepCount = 0;
+
+	// Passes that rebuild the cell lists; with a Verlet skin their group counts come from
+	// the matching command in ssboVerletState
+	enum VerletCommand { VerletParticleGroups, VerletSortTiles, VerletSingleGroup };
+	bool verletForceRebuild = true;		// no valid lists yet / the cell buffers or the key mode changed
+	double neighborRebuildRate = 1.0;		// rebuilt substeps / substeps, from verletReadback
+
 	void InitParticles();
 	void SetParticlesColors();
 	void InitSSBOs();
 	void InitComputeShaders();
 	void InitSimulation();
 	void UpdateGrid();
-
-	void PrintTimes() const;
-
-	// Time measures
+	void CheckCellCapacity();
+	void CheckVerletSkin();
+	void DispatchRebuildPass(const ComputeShader& shader, GLuint numGroups, VerletCommand command);
+	void PollVerletState();
+	void InitProfiler();
+	void UpdateTimings();
+
+	// GPU profiling (GL_TIMESTAMP queries, see GpuProfiler); one stage per gpu*_ms field
+	enum ProfileStage
+	{
+		StageUpdateGrid, StageIntegrate, StageHash, StageRadixSort, StageFindCellBounds,
+		StagePBF, StageUpdateVelocity, StageXSPH, StageViscosity, StageCollisions
+	};
+	GpuProfiler profiler;
+	const int profileWindow = 60;		// frames averaged per value
+
+	// Time measures (per frame: all the substeps of Step())
 	double cpuUpdateGrid_ms = 0.0;
 
+	double gpuUpdateGrid_ms = 0.0;
 	double gpuIntegrate_ms = 0.0;
 	double gpuHash_ms = 0.0;
 	double gpuRadixShort_ms = 0.0;
@@ -131,13 +195,30 @@ public:
 	//void Test();
 	void Test(int n);
 
-	int currentTotCells = totCells;
-
 	void ResizeCellBuffers(GLuint newTotCells);
 
+	void PrintTimes() const;
+	inline GpuProfiler& GetProfiler()				{ return profiler; }
+	inline double GetCpuUpdateGridMs() const		{ return cpuUpdateGrid_ms; }
+	// Fraction of the substeps that re-sorted the particles (1 without a Verlet skin; a few frames late)
+	inline double GetNeighborRebuildRate() const	{ return neighborRebuildRate; }
+
+	inline void SetCellKeyMode(CellKeyMode mode)	{ cellKeyMode = mode; verletForceRebuild = true; }
+	inline CellKeyMode GetCellKeyMode() const		{ return cellKeyMode; }
+
 	inline GLuint GetParticlesSSBO() const	{ return ssboParticles; }
 	inline GLuint GetNumParticles() const	{ return numParticles; }
 
+	// Particles are stored in cell order; this returns them indexed by their stable ID (meta.y)
+	void ReadParticlesByID(std::vector<PBF_GPU_Particle>& out) const;
+
+	// Asynchronous variant: while enabled, every Step() queues a copy of the particles and
+	// PollParticles returns the oldest finished one (false if none is ready), without stalling
+	inline void SetParticleCapture(bool enabled)	{ captureParticles = enabled; }
+	inline bool GetParticleCapture() const			{ return captureParticles; }
+	bool PollParticles(std::vector<PBF_GPU_Particle>& out, uint64_t* frame = nullptr);
+	inline uint64_t GetNumDroppedCaptures() const	{ return particleReadback.numDropped(); }
+
 	inline int NextPowerOfTwo(int v) {
 		v--;
 		v |= v >> 1;
@@ -0,0 +1,19 @@
+// PBF_GPU_VerletState.h
+#pragma once
+
+#include <glad/glad.h>
+
+// Verlet neighbor lists on the GPU (SSBO 19): VerletCheck.comp measures how far the particles
+// moved since the cell lists were last built and VerletDecide.comp turns it into the indirect
+// dispatch arguments of the rebuild passes (zero groups while the lists are still valid).
+// This struct mirrors the std430 layout in the GLSL compute shaders.
+struct PBF_GPU_VerletState
+{
+    GLuint dispatch[3][3];          // one (x, y, z) command per PBF_GPU_System::VerletCommand
+    GLuint maxDisplacementBits;     // largest displacement since the last build (float bits, >= 0)
+    GLuint rebuild;                 // 1 if the current substep rebuilds the cell lists
+    GLuint numChecks;               // substeps checked since the counters were reset
+    GLuint numRebuilds;             // of which rebuilt the cell lists
+};
+
+static_assert(sizeof(PBF_GPU_VerletState) == 52, "PBF_GPU_VerletState must match the GLSL std430 layout");
@@ -1,15 +1,107 @@
 // PBF_Particle.h
 #pragma once
 
+#include <vector>
+
 #include "../support/Common.h"
 
-struct PBF_Particle
+template <typename T>
+struct PBF_ParticleT
 {
-    int    i;
-    Scalar m;
-    Vec3   x;
-    Vec3   v;
-    Vec3   p;
+    int      i;
+    T        m;
+    Vec3T<T> x;
+    Vec3T<T> v;
+    Vec3T<T> p;
 
     Eigen::Vector3f color = Eigen::Vector3f(0.0f, 0.0f, 1.0f);
 };
+
+// Structure-of-arrays storage used by the CPU solver.
+// Positions, predicted positions and velocities are N x 3 column-major matrices,
+// so every component (x, y, z) is its own contiguous array: col(0) is all the x's.
+template <typename T>
+struct PBF_ParticleDataT
+{
+    using Vec3Array = Eigen::Matrix<T, Eigen::Dynamic, 3>;
+
+    VecXT<T>  m;
+    Vec3Array x;
+    Vec3Array v;
+    Vec3Array p;
+
+    // Cold data, only read when building PBF_Particle copies
+    std::vector<Eigen::Vector3f> color;
+
+    inline int size() const { return static_cast<int>(m.size()); }
+
+    inline void resize(const int n)
+    {
+        m.resize(n);
+        x.resize(n, 3);
+        v.resize(n, 3);
+        p.resize(n, 3);
+        color.resize(n, Eigen::Vector3f(0.0f, 0.0f, 1.0f));
+    }
+
+    inline PBF_ParticleT<T> get(const int index) const
+    {
+        PBF_ParticleT<T> particle;
+        particle.i = index;
+        particle.m = m[index];
+        particle.x = x.row(index).transpose();
+        particle.v = v.row(index).transpose();
+        particle.p = p.row(index).transpose();
+        particle.color = color[index];
+        return particle;
+    }
+
+    // Same particles in another precision (used to start float and double runs from one state)
+    template <typename U>
+    inline PBF_ParticleDataT<U> cast() const
+    {
+        PBF_ParticleDataT<U> other;
+        other.m = m.template cast<U>();
+        other.x = x.template cast<U>();
+        other.v = v.template cast<U>();
+        other.p = p.template cast<U>();
+        other.color = color;
+        return other;
+    }
+};
+
+// Read-only array-of-structs view over PBF_ParticleData.
+// Keeps code written against PBF_Particle working on top of the SoA storage;
+// elements are assembled on access, so hold on to copies rather than references.
+template <typename T>
+class PBF_ParticleViewT
+{
+public:
+    class Iterator
+    {
+    public:
+        Iterator(const PBF_ParticleDataT<T>& data, const int index) : m_data(&data), m_index(index) {}
+
+        inline PBF_ParticleT<T> operator*() const { return m_data->get(m_index); }
+        inline Iterator& operator++() { ++m_index; return *this; }
+        inline bool operator==(const Iterator& other) const { return m_index == other.m_index; }
+        inline bool operator!=(const Iterator& other) const { return m_index != other.m_index; }
+    private:
+        const PBF_ParticleDataT<T>* m_data;
+        int                         m_index;
+    };
+
+    explicit PBF_ParticleViewT(const PBF_ParticleDataT<T>& data) : m_data(data) {}
+
+    inline int size() const { return m_data.size(); }
+    inline PBF_ParticleT<T> operator[](const int index) const { return m_data.get(index); }
+
+    inline Iterator begin() const { return Iterator(m_data, 0); }
+    inline Iterator end() const { return Iterator(m_data, size()); }
+private:
+    const PBF_ParticleDataT<T>& m_data;
+};
+
+using PBF_Particle = PBF_ParticleT<Scalar>;
+using PBF_ParticleData = PBF_ParticleDataT<Scalar>;
+using PBF_ParticleView = PBF_ParticleViewT<Scalar>;
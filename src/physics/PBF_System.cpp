@@ -1,52 +1,114 @@
 // PBF_System.cpp
 #include "PBF_System.h"
+#include "../support/Timer.h"
 
-Scalar PBF_System::CalcDensity(const int target_index)
-{
-    const auto& p_target = particles[target_index];
+#include <algorithm>
+#include <cassert>
 
-    Scalar density = 0.0;
-    for (int neighbor_index : neighborSearchEngine.retrieveNeighbors(target_index))
+template <typename T>
+void PBF_SystemT<T>::NeighborhoodScratch::reserve(const int n)
+{
+    // Grow only
+    if (static_cast<int>(w.size()) < n)
     {
-        const auto& p = particles[neighbor_index];
-        density += p.m * CalcKernel(p_target.p - p.p, radius);
+        for (std::vector<T>* buffer : { &r_x, &r_y, &r_z, &w, &g_x, &g_y, &g_z })
+        {
+            buffer->resize(n);
+        }
     }
-
-    return density;
 }
 
-Scalar PBF_System::CalcConstraint(const int target_index)
+template <typename T>
+typename PBF_SystemT<T>::NeighborhoodScratch& PBF_SystemT<T>::ThreadScratch()
 {
-    const Scalar density = CalcDensity(target_index);
-    return (density / restDensity) - 1.0;
+    return scratch[omp_get_thread_num()];
 }
 
-Vec3 PBF_System::CalcGradConstraint(const int target_index, const int var_index)
+template <typename T>
+void PBF_SystemT<T>::GatherRelativePositions(const Vec3Array& positions, const int target_index, const NeighborSpan& neighbors, NeighborhoodScratch& s) const
 {
-    const PBF_Particle& p_target = particles[target_index];
+    const int numNeighbors = neighbors.size();
+    s.reserve(numNeighbors);
 
-    if (target_index == var_index)
+    Scalar* rel[3] = { s.r_x.data(), s.r_y.data(), s.r_z.data() };
+
+    for (int c = 0; c < 3; ++c)
     {
-        Vec3 sum = Vec3::Zero();
+        const Scalar* src = positions.col(c).data();
+        Scalar* dst = rel[c];
+        const Scalar target = src[target_index];
 
-        for (int neighbor_index : neighborSearchEngine.retrieveNeighbors(target_index))
+        for (int j = 0; j < numNeighbors; ++j)
         {
-            const auto& p = particles[neighbor_index];
-
-            sum += p.m * CalcGradKernel(p_target.p - p.p, radius);
+            dst[j] = target - src[neighbors[j]];
         }
+    }
+}
+
+template <typename T>
+T PBF_SystemT<T>::CalcDensity(const int target_index)
+{
+    const NeighborSpan neighbors = neighborSearchEngine.retrieveNeighbors(target_index);
+    const int numNeighbors = neighbors.size();
+
+    NeighborhoodScratch& s = ThreadScratch();
+    GatherRelativePositions(particles.p, target_index, neighbors, s);
+
+    CalcKernelBatch(kernelCoeffs, s.r_x.data(), s.r_y.data(), s.r_z.data(), numNeighbors, s.w.data());
 
-        return sum / restDensity;
+    Scalar density = 0.0;
+    for (int j = 0; j < numNeighbors; ++j)
+    {
+        density += particles.m[neighbors[j]] * s.w[j];
     }
-    else
+
+    return density;
+}
+
+template <typename T>
+T PBF_SystemT<T>::CalcLambda(const int target_index)
+{
+    const NeighborSpan neighbors = neighborSearchEngine.retrieveNeighbors(target_index);
+    const int numNeighbors = neighbors.size();
+
+    // Kernel values and gradients for the whole neighborhood at once
+    NeighborhoodScratch& s = ThreadScratch();
+    GatherRelativePositions(particles.p, target_index, neighbors, s);
+
+    CalcKernelBatch(kernelCoeffs, s.r_x.data(), s.r_y.data(), s.r_z.data(), numNeighbors, s.w.data());
+    CalcGradKernelBatch(kernelCoeffs, s.r_x.data(), s.r_y.data(), s.r_z.data(), numNeighbors,
+                        s.g_x.data(), s.g_y.data(), s.g_z.data());
+
+    // Single pass over the neighbors (same as ComputeLambda.comp): density, the
+    // gradient of the constraint w.r.t. the particle itself and the squared
+    // gradients w.r.t. every neighbor. The self pair has a zero gradient, so it
+    // only contributes to the density.
+    Scalar density = 0.0;
+    Vec3 grad_i = Vec3::Zero();
+    Scalar sum_grad_squared = 0.0;
+
+    for (int j = 0; j < numNeighbors; ++j)
     {
-        const auto& p = particles[var_index];
+        const Scalar m_j = particles.m[neighbors[j]];
+        const Vec3 grad_j = (m_j / restDensity) * Vec3(s.g_x[j], s.g_y[j], s.g_z[j]);
 
-        return -p.m * CalcGradKernel(p_target.p - p.p, radius) / restDensity;
+        density += m_j * s.w[j];
+        grad_i += grad_j;
+
+        // Note: In Eq.12, the inverse mass is dropped for simplicity
+        sum_grad_squared += (Scalar(1) / m_j) * grad_j.squaredNorm();
     }
+    sum_grad_squared += (Scalar(1) / particles.m[target_index]) * grad_i.squaredNorm();
+
+    const Scalar constraint = (density / restDensity) - Scalar(1);
+
+    // Note: Add an epsilon value for relaxation (see Eq.11)
+    // TODO: Check this equation
+    return -constraint / (sum_grad_squared + epsilon);
 }
 
-void PBF_System::PrintAverageNumNeighbors()
+template <typename T>
+void PBF_SystemT<T>::PrintAverageNumNeighbors()
 {
     const int num_particles = neighborSearchEngine.getNumParticles();
 
@@ -56,10 +118,11 @@ void PBF_System::PrintAverageNumNeighbors()
         nums[i] = neighborSearchEngine.retrieveNeighbors(i).size();
     }
 
-    printf("Average(#neighbors): %d\n",nums.mean());
+    printf("Average(#neighbors): %f\n", static_cast<double>(nums.mean()));
 }
 
-void PBF_System::PrintAverageDensity()
+template <typename T>
+void PBF_SystemT<T>::PrintAverageDensity()
 {
     VecX buffer(particles.size());
     for (int i = 0; i < particles.size(); ++i)
@@ -67,36 +130,31 @@ void PBF_System::PrintAverageDensity()
         buffer[i] = CalcDensity(i);
     }
 
-    printf("Average(density): %d\n", buffer.mean());
+    printf("Average(density): %f\n", static_cast<double>(buffer.mean()));
 }
 
-void PBF_System::SetParticlesColors()
+template <typename T>
+void PBF_SystemT<T>::SetParticlesColors()
 {
     // Calcular rango de Y para el gradiente
-    Scalar minY = std::numeric_limits<Scalar>::max();
-    Scalar maxY = std::numeric_limits<Scalar>::lowest();
-    for (const auto& p : particles)
-    {
-        Scalar y = p.x.y();
-        if (y < minY) minY = y;
-        if (y > maxY) maxY = y;
-    }
+    Scalar minY = particles.x.col(1).minCoeff();
+    Scalar maxY = particles.x.col(1).maxCoeff();
 
     // Evitar divisi�n por cero
-    if (maxY == minY) maxY += 1.0;
+    if (maxY == minY) maxY += Scalar(1);
 
     // Asignar colores en arco�ris seg�n Y
-    for (auto& p : particles)
+    for (int k = 0; k < particles.size(); ++k)
     {
         // Normalizar Y entre 0 y 1 (invertido para arriba-abajo)
-        Scalar t = (maxY - p.x.y()) / (maxY - minY);
+        Scalar t = (maxY - particles.x(k, 1)) / (maxY - minY);
 
         // Convertir a HSV (Hue: 0�=rojo, 300�=magenta)
         Scalar hue = t * 300.0;
         Scalar s = 1.0, v = 1.0;
         Scalar c = v * s;
         Scalar h_prime = hue / 60.0;
-        Scalar x = c * (1 - std::abs(std::fmod(h_prime, 2.0) - 1.0));
+        Scalar x = c * (1 - std::abs(std::fmod(h_prime, Scalar(2)) - 1));
         Scalar m = v - c;
 
         int i = static_cast<int>(h_prime) % 6;
@@ -113,65 +171,60 @@ void PBF_System::SetParticlesColors()
         }
 
         // Ajustar brillo y asegurar rango [0,1]
-        p.color = Eigen::Vector3f(
-            std::clamp(r + m, 0.0, 1.0),
-            std::clamp(g + m, 0.0, 1.0),
-            std::clamp(b + m, 0.0, 1.0)
+        particles.color[k] = Eigen::Vector3f(
+            static_cast<float>(std::clamp<Scalar>(r + m, 0.0, 1.0)),
+            static_cast<float>(std::clamp<Scalar>(g + m, 0.0, 1.0)),
+            static_cast<float>(std::clamp<Scalar>(b + m, 0.0, 1.0))
         );
     }
 }
 
-void PBF_System::InitSystem()
+template <typename T>
+void PBF_SystemT<T>::InitSystem()
 {
-    printf("#### PBF System ####\n");
-    printf("Particles: %d\n", numParticles);
-    printf("TimeStep: %f\n", timeStep);
-    printf("SubSteps: %d\n", numSubSteps);
+    fprintf(stderr, "#### PBF System ####\n");
+    fprintf(stderr, "Particles: %d\n", numParticles);
+    fprintf(stderr, "TimeStep: %f\n", timeStep);
+    fprintf(stderr, "SubSteps: %d\n", numSubSteps);
 
     particles.resize(numParticles);
     for (int i = 0; i < numParticles; ++i)
     {
-        particles[i].i = i;
-        particles[i].m = 3000.0 / static_cast<Scalar>(numParticles);
+        particles.m[i] = 3000.0 / static_cast<Scalar>(numParticles);
         /*
         // Generar posiciones dentro de una esfera de radio centrada en (0, 4, 0)
         Vec3 spherePos = Vec3::Random().normalized();
         spherePos *= 0.75; // Escalar al radio deseado
-        particles[i].x = spherePos + Vec3(0.0, 4.0, 0.0);
+        particles.x.row(i) = (spherePos + Vec3(0.0, 4.0, 0.0)).transpose();
         */
         // Generar posiciones en un paralelepipedo
-        particles[i].x = Vec3(0.5, 2.0, 0.5).cwiseProduct(Vec3::Random()) + Vec3(0.0, 4.0, 0.0);
-        particles[i].v = Vec3::Zero();
+        particles.x.row(i) = (Vec3(0.5, 2.0, 0.5).cwiseProduct(Vec3::Random()) + Vec3(0.0, 4.0, 0.0)).transpose();
+        particles.v.row(i).setZero();
     }
 
     // Relax initial particle positions (a dirty solution for resolving bad initial states)
     constexpr int num_relax_steps = 20;
     for (int k = 0; k < num_relax_steps; ++k)
     {
-        const Scalar damping = std::min(1.0, (static_cast<Scalar>(k) * 2.0 / static_cast<Scalar>(num_relax_steps)));
+        const Scalar damping = std::min<Scalar>(1.0, (static_cast<Scalar>(k) * 2.0 / static_cast<Scalar>(num_relax_steps)));
 
         // Step the simulation time forward using a very small time step
-        Step(1e-04 * timeStep);
+        Step(Scalar(1e-04) * timeStep);
 
         // Damp velocities for stability
-        for (auto& p : particles)
-        {
-            p.v = damping * p.v;
-        }
+        particles.v *= damping;
     }
 
-    for (auto& p : particles)
-    {
-        p.v = Vec3::Zero();
-        //p.v = Vec3(15.0, 0.0, 0.0);
-    }
+    particles.v.setZero();
+    //particles.v.col(0).setConstant(15.0);
 
     
 }
 
 
 
-PBF_System::PBF_System() : neighborSearchEngine(radius, particles)
+template <typename T>
+PBF_SystemT<T>::PBF_SystemT(const int numParticles) : numParticles(numParticles), neighborSearchEngine(radius, particles)
 {
     // Init Particles
     InitSystem();
@@ -179,12 +232,14 @@ PBF_System::PBF_System() : neighborSearchEngine(radius, particles)
     SetParticlesColors();
 }
 
-PBF_System::~PBF_System() 
+template <typename T>
+PBF_SystemT<T>::~PBF_SystemT() 
 {
 	//free(particles);
 }
 
-void PBF_System::AnimationStep()
+template <typename T>
+void PBF_SystemT<T>::AnimationStep()
 {
     const Scalar sub_dt = timeStep / static_cast<Scalar>(numSubSteps);
 
@@ -194,20 +249,24 @@ void PBF_System::AnimationStep()
     }
 }
 
-void PBF_System::Step(const Scalar dt)
+template <typename T>
+void PBF_SystemT<T>::Step(const Scalar dt)
 {
     //printf("Number of particles %d\n", particles.size());
+    StageTimer timer;
 
     // Predict positions using the semi-implicit Euler integration
-    #pragma omp parallel for
-    for (int i = 0; i < numParticles; ++i)
+    particles.v.col(1).array() += dt * Scalar(-9.8);
+    particles.p = particles.x + dt * particles.v;
+    timer.lap(timings.integrate);
+
+    // Perform neighbor search based on updated positions (with a skin, only when the
+    // particles have moved too far from where the lists were built)
+    if (neighborSearchEngine.updateNeighbors())
     {
-        particles[i].v = particles[i].v + dt * Vec3(0.0, -9.8, 0.0);
-        particles[i].p = particles[i].x + dt * particles[i].v;
+        ++timings.neighborBuilds;
     }
-
-    // Perform neighbor search based on updated positions
-    neighborSearchEngine.searchNeighbors();
+    timer.lap(timings.neighborSearch);
 
     if (verbose)
     {
@@ -215,105 +274,117 @@ void PBF_System::Step(const Scalar dt)
         PrintAverageDensity();
     }
 
-    const int num_iters = 2;
-    #pragma omp parallel for
-    for (int k = 0; k < num_iters; ++k)
+    // Workspace and per-thread scratch keep their storage between steps
+    lambda.resize(numParticles);
+    deltaP.resize(numParticles, 3);
+    densities.resize(numParticles);
+    deltaV.resize(numParticles, 3);
+    if (static_cast<int>(scratch.size()) < omp_get_max_threads())
+    {
+        scratch.resize(omp_get_max_threads());
+    }
+    for (NeighborhoodScratch& s : scratch)
+    {
+        // No neighborhood holds more than every particle, so the neighbor loops never allocate
+        s.reserve(numParticles);
+    }
+
+    // Jacobi iterations: they depend on each other and run in order; inside each one
+    // every phase is a parallel loop over particles that only writes its own entries,
+    // so the result does not depend on the number of threads.
+    for (int k = 0; k < numIter; ++k)
     {
-        VecX lambda(numParticles);
+        // Calculate lambda (Eq.11)
+        #pragma omp parallel for schedule(static)
         for (int i = 0; i < numParticles; ++i)
         {
-            const PBF_Particle& p = particles[i];
-            const Scalar numerator = CalcConstraint(i);
-
-            Scalar denominator = 0.0;
-
-            #pragma omp parallel for
-            for (int neighbor_index : neighborSearchEngine.retrieveNeighbors(i))
-            {
-                const Vec3 grad = CalcGradConstraint(i, neighbor_index);
-
-                // Note: In Eq.12, the inverse mass is dropped for simplicity
-                denominator += (1.0 / particles[neighbor_index].m) * grad.squaredNorm();
-            }
-
-
-            // Note: Add an epsilon value for relaxation (see Eq.11)
-            // TODO: Check this equation
-            denominator += epsilon;
-
-            lambda[i] = -numerator / denominator;
+            lambda[i] = CalcLambda(i);
         }
+        timer.lap(timings.lambda);
 
         // Calculate delta p in the Jacobi style
-        MatX delta_p(3, numParticles);
+        // Calculate the artificial tensile pressure correction constants
+        // (corr_n = 4 is applied below as two squarings instead of std::pow)
+        constexpr Scalar corr_h = 0.30;
+        const Scalar corr_w = CalcKernel<Scalar>(corr_h * radius * Vec3::UnitX(), radius);
 
-
-        #pragma omp parallel for
+        #pragma omp parallel for schedule(static)
         for (int i = 0; i < numParticles; ++i)
         {
-            const PBF_Particle& p = particles[i];
-            const auto& neighbors = neighborSearchEngine.retrieveNeighbors(i);
+            const Scalar m_i = particles.m[i];
+            const NeighborSpan neighbors = neighborSearchEngine.retrieveNeighbors(i);
             const int numNeighbors = neighbors.size();
 
-            // Calculate the artificial tensile pressure correction constant
-            constexpr Scalar corr_n = 4.0;
-            constexpr Scalar corr_h = 0.30;
-            const Scalar corr_k = p.m * 1.0e-04; // Note: This equation has no ground and may not work well
-            const Scalar corr_w = CalcKernel(corr_h * radius * Vec3::UnitX(), radius);
+            const Scalar corr_k = m_i * Scalar(1.0e-04); // Note: This equation has no ground and may not work well
+
+            // Kernel values and gradients for the whole neighborhood at once
+            NeighborhoodScratch& s = ThreadScratch();
+            GatherRelativePositions(particles.p, i, neighbors, s);
+
+            CalcKernelBatch(kernelCoeffs, s.r_x.data(), s.r_y.data(), s.r_z.data(), numNeighbors, s.w.data());
+            CalcGradKernelBatch(kernelCoeffs, s.r_x.data(), s.r_y.data(), s.r_z.data(), numNeighbors,
+                                s.g_x.data(), s.g_y.data(), s.g_z.data());
 
             // Calculate the sum of pressure effect (Eq.12)
-            MatX buffer(3, numNeighbors);
-            #pragma omp parallel for
+            Vec3 sum = Vec3::Zero();
             for (int j = 0; j < numNeighbors; ++j)
             {
                 const int neighborIndex = neighbors[j];
 
                 // Calculate the artificial tensile pressure correction
-                const Scalar kernel_val = CalcKernel(p.p - particles[neighborIndex].p, radius);
-                const Scalar ratio = kernel_val / corr_w;
-                const Scalar corr_coeff = -corr_k * std::pow(ratio, corr_n);
+                const Scalar ratio = s.w[j] / corr_w;
+                const Scalar ratio_squared = ratio * ratio;
+                const Scalar corr_coeff = -corr_k * ratio_squared * ratio_squared;
 
-                const Scalar coeff = particles[neighborIndex].m * (lambda[i] + lambda[neighborIndex] + corr_coeff);
+                const Scalar coeff = particles.m[neighborIndex] * (lambda[i] + lambda[neighborIndex] + corr_coeff);
 
-                buffer.col(j) = coeff * CalcGradKernel(p.p - particles[neighborIndex].p, radius);
+                sum += coeff * Vec3(s.g_x[j], s.g_y[j], s.g_z[j]);
             }
-            const Vec3 sum = buffer.rowwise().sum();
 
             // Calculate delta p of this particle
-            delta_p.col(i) = (1.0 / p.m) * (1.0 / restDensity) * sum;
+            deltaP.row(i) = ((Scalar(1) / m_i) * (Scalar(1) / restDensity) * sum).transpose();
         }
 
         // Apply delta p in the Jacobi style
-        #pragma omp parallel for
-        for (int i = 0; i < numParticles; ++i)
-        {
-            particles[i].p += delta_p.col(i);
-        }
-
-        // Solve collision constraints
-        #pragma omp parallel for
+        #pragma omp parallel for schedule(static)
         for (int i = 0; i < numParticles; ++i)
         {
-            auto& p = particles[i];
+            particles.p.row(i) += deltaP.row(i);
 
+            // Solve collision constraints
             // Detect and resolve environmental collisions (in a very naive way)
-            p.p = p.p.cwiseMax(Vec3(-30.0, 0.0, -30.0));
-            p.p = p.p.cwiseMin(Vec3(+30.0, 8.0, +30.0));
+            particles.p(i, 0) = std::clamp(particles.p(i, 0), Scalar(-30), Scalar(+30));
+            particles.p(i, 1) = std::clamp(particles.p(i, 1), Scalar(0), Scalar(8));
+            particles.p(i, 2) = std::clamp(particles.p(i, 2), Scalar(-30), Scalar(+30));
         }
+        timer.lap(timings.deltaP);
     }
     // Update positions and velocities
-    #pragma omp parallel for
-    for(int i = 0; i < numParticles; ++i)
+    particles.v = damping * (particles.p - particles.x) / dt;
+    particles.x = particles.p;
+    timer.lap(timings.integrate);
+
+    // Apply the XSPH viscosity effect [Schechter+, SIGGRAPH 2012]
+    // Update positions and velocities
+    if (symmetricPairs)
     {
-        particles[i].v = damping * (particles[i].p - particles[i].x) / dt;
-        particles[i].x = particles[i].p;
+        ApplyXSPHPairs();
+    }
+    else
+    {
+        ApplyXSPH();
     }
 
-    // Apply the XSPH viscosity effect [Schechter+, SIGGRAPH 2012]
-    VecX densities(numParticles);
-    MatX delta_v(3, numParticles);
+    particles.v += deltaV;
+    // TODO: Apply vorticity confinement
 
-    // Update positions and velocities
+    timer.lap(timings.xsph);
+    ++timings.steps;
+}
+
+template <typename T>
+void PBF_SystemT<T>::ApplyXSPH()
+{
     #pragma omp parallel for
     for (int i = 0; i < numParticles; ++i)
     {
@@ -323,29 +394,154 @@ void PBF_System::Step(const Scalar dt)
     #pragma omp parallel for
     for (int i = 0; i < numParticles; ++i)
     {
-        const PBF_Particle& p = particles[i];
-        const auto& neighbors = neighborSearchEngine.retrieveNeighbors(i);
+        const Vec3 v_i = particles.v.row(i).transpose();
+        const Scalar m_i = particles.m[i];
+        const NeighborSpan neighbors = neighborSearchEngine.retrieveNeighbors(i);
         const int numNeighbors = neighbors.size();
 
-        MatX buffer(3, numNeighbors);
-        #pragma omp parallel for
+        NeighborhoodScratch& s = ThreadScratch();
+        GatherRelativePositions(particles.x, i, neighbors, s);
+
+        CalcKernelBatch(kernelCoeffs, s.r_x.data(), s.r_y.data(), s.r_z.data(), numNeighbors, s.w.data());
+
+        Vec3 sum = Vec3::Zero();
         for (int j = 0; j < numNeighbors; ++j)
         {
             const int neighbor_index = neighbors[j];
-            const Scalar kernel_val = CalcKernel(p.x - particles[neighbor_index].x, radius);
-            const auto rel_velocity = particles[neighbor_index].v - p.v;
+            const Vec3 rel_velocity = particles.v.row(neighbor_index).transpose() - v_i;
 
-            buffer.col(j) = (p.m / densities[neighbor_index]) * kernel_val * rel_velocity;
+            sum += (m_i / densities[neighbor_index]) * s.w[j] * rel_velocity;
         }
-        const auto sum = buffer.rowwise().sum();
 
-        delta_v.col(i) = viscosity * sum;
+        deltaV.row(i) = (viscosity * sum).transpose();
     }
-    
-    #pragma omp parallel for
-    for (int i = 0; i < numParticles; ++i)
+}
+
+// Same densities and XSPH sums over half neighbor lists: the lists are symmetric, so each
+// pair (i, j) is evaluated once, from i, for j > i. W_ij is computed once for both passes
+// (x = p here, the positions the densities use) and the j side of every sum goes to the
+// thread's reaction buffer: m_i W_ij to rho_j, and -(m_j / rho_i) W_ij (v_j - v_i) to dv_j.
+template <typename T>
+void PBF_SystemT<T>::ApplyXSPHPairs()
+{
+    HalfPairs& h = halfPairs;
+    const int numBuffers = omp_get_max_threads();
+    if (static_cast<int>(h.densityReactions.size()) != numBuffers || h.densityReactions[0].size() != numParticles)
     {
-        particles[i].v += delta_v.col(i);
+        h.densityReactions.assign(numBuffers, VecX::Zero(numParticles));
+        h.velocityReactions.assign(numBuffers, Vec3Array::Zero(numParticles, 3));
     }
-    // TODO: Apply vorticity confinement
+    // Sliced like the CSR neighbor array, and grown the same way (twice what is needed)
+    const std::size_t numNeighbors = neighborSearchEngine.getNumNeighbors();
+    if (h.index.capacity() < numNeighbors)
+    {
+        h.index.reserve(2 * numNeighbors);
+        h.w.reserve(2 * numNeighbors);
+    }
+    h.count.resize(numParticles);
+    h.index.resize(numNeighbors);
+    h.w.resize(numNeighbors);
+
+    const Scalar w_self = CalcKernel<Scalar>(Vec3::Zero(), radius);
+
+    #pragma omp parallel
+    {
+        VecX& densityReaction = h.densityReactions[omp_get_thread_num()];
+        Vec3Array& velocityReaction = h.velocityReactions[omp_get_thread_num()];
+
+        // Half lists, stored in each particle's slice of the CSR neighbor array
+        #pragma omp for schedule(static)
+        for (int i = 0; i < numParticles; ++i)
+        {
+            const int offset = neighborSearchEngine.getNeighborOffset(i);
+            int* half = h.index.data() + offset;
+            Scalar* w = h.w.data() + offset;
+
+            int numHalf = 0;
+            for (const int j : neighborSearchEngine.retrieveNeighbors(i))
+            {
+                if (j > i)
+                {
+                    half[numHalf++] = j;
+                }
+            }
+            h.count[i] = numHalf;
+
+            NeighborhoodScratch& s = ThreadScratch();
+            GatherRelativePositions(particles.x, i, NeighborSpan(half, half + numHalf), s);
+
+            CalcKernelBatch(kernelCoeffs, s.r_x.data(), s.r_y.data(), s.r_z.data(), numHalf, w);
+
+            const Scalar m_i = particles.m[i];
+            Scalar density = m_i * w_self;
+            for (int k = 0; k < numHalf; ++k)
+            {
+                density += particles.m[half[k]] * w[k];
+                densityReaction[half[k]] += m_i * w[k];
+            }
+            densities[i] = density;
+        }
+
+        #pragma omp for schedule(static)
+        for (int i = 0; i < numParticles; ++i)
+        {
+            for (VecX& buffer : h.densityReactions)
+            {
+                densities[i] += buffer[i];
+                buffer[i] = Scalar(0);
+            }
+        }
+
+        #pragma omp for schedule(static)
+        for (int i = 0; i < numParticles; ++i)
+        {
+            const int offset = neighborSearchEngine.getNeighborOffset(i);
+            const int* half = h.index.data() + offset;
+            const Scalar* w = h.w.data() + offset;
+
+            const Vec3 v_i = particles.v.row(i).transpose();
+            const Scalar m_i = particles.m[i];
+            const Scalar rho_i = densities[i];
+
+            Vec3 sum = Vec3::Zero();
+            for (int k = 0; k < h.count[i]; ++k)
+            {
+                const int j = half[k];
+                const Vec3 term = w[k] * (particles.v.row(j).transpose() - v_i);
+
+                sum += (m_i / densities[j]) * term;
+                velocityReaction.row(j) -= ((particles.m[j] / rho_i) * term).transpose();
+            }
+
+            deltaV.row(i) = sum.transpose();
+        }
+
+        #pragma omp for schedule(static)
+        for (int i = 0; i < numParticles; ++i)
+        {
+            for (Vec3Array& buffer : h.velocityReactions)
+            {
+                deltaV.row(i) += buffer.row(i);
+                buffer.row(i).setZero();
+            }
+            deltaV.row(i) *= viscosity;
+        }
+    }
+}
+
+template <typename T>
+void PBF_SystemT<T>::SetParticleData(const ParticleData& data)
+{
+    assert(data.size() == particles.size());
+
+    particles.m = data.m;
+    particles.x = data.x;
+    particles.v = data.v;
+    particles.p = data.p;
+    particles.color = data.color;
+
+    neighborSearchEngine.invalidateNeighbors();
 }
+
+template class PBF_SystemT<float>;
+template class PBF_SystemT<double>;
@@ -2,21 +2,46 @@
 #pragma once
 
 #include <omp.h>
+#include <vector>
 
 #include "PBF_Particle.h"
 #include "../support/Common.h"
 #include "./searchEngine/HashGrid.h"
 #include "./maths/Kernel.h"
 
-class PBF_System
+// Accumulated wall time of each stage of PBF_SystemT::Step, in milliseconds
+struct PBF_StepTimings
 {
+	double integrate = 0.0;       // prediction + position/velocity update
+	double neighborSearch = 0.0;
+	double lambda = 0.0;
+	double deltaP = 0.0;          // delta p + apply/collisions
+	double xsph = 0.0;            // densities + XSPH viscosity
+	int    steps = 0;
+	int    neighborBuilds = 0;    // steps that rebuilt the neighbor lists
+
+	inline double total() const { return integrate + neighborSearch + lambda + deltaP + xsph; }
+	inline double neighborRebuildRate() const { return steps > 0 ? double(neighborBuilds) / double(steps) : 0.0; }
+};
+
+// CPU Position Based Fluids solver, templated on its scalar type.
+// PBF_SystemT<float> and PBF_SystemT<double> are both compiled (see PBF_System.cpp),
+// so the precision can be picked at runtime; PBF_System is the build default (Scalar).
+template <typename T>
+class PBF_SystemT
+{
+public:
+	using Scalar = T;
+	using Vec3 = Vec3T<T>;
+	using VecX = VecXT<T>;
+	using ParticleData = PBF_ParticleDataT<T>;
+	using Vec3Array = typename ParticleData::Vec3Array;
 private:
-	// Data
-	std::vector<PBF_Particle> particles;
+	// Data (structure of arrays, see PBF_ParticleDataT)
+	ParticleData particles;
 
 	// Simulation params
-	const int numParticles = 10800;
-	//const int numParticles = 5400;
+	const int numParticles;
 	const int numSubSteps = 5;
 	const int numIter = 2;
 
@@ -27,28 +52,96 @@ private:
 	const Scalar damping = 0.999;
 	const Scalar viscosity = 0.050;
 
+	// Kernel constants for h = radius, shared by all the batched kernel calls
+	const KernelCoefficientsT<T> kernelCoeffs = KernelCoefficientsT<T>(radius);
+
 	const bool verbose = false;
 
-	HashGrid neighborSearchEngine;
+	PBF_StepTimings timings;
+
+	HashGridT<T> neighborSearchEngine;
+
+	// Solver workspace, sized once and reused by every Step
+	VecX lambda;
+	Vec3Array deltaP;
+	VecX densities;
+	Vec3Array deltaV;
+
+	// Densities and XSPH over half neighbor lists: the neighbors j > i of each particle and
+	// their kernel values (in the particle's slice of the CSR neighbor array), and the
+	// reactions to the partners, one buffer per OpenMP thread
+	struct HalfPairs
+	{
+		std::vector<int> count;
+		std::vector<int> index;
+		std::vector<T> w;
+		std::vector<VecX> densityReactions;
+		std::vector<Vec3Array> velocityReactions;
+	};
+	bool symmetricPairs = false;
+	HalfPairs halfPairs;
+
+	// Scratch for the neighborhood of one particle (relative positions, kernel values
+	// and gradients as separate x/y/z arrays for the batched kernels)
+	struct NeighborhoodScratch
+	{
+		std::vector<T> r_x, r_y, r_z;
+		std::vector<T> w;
+		std::vector<T> g_x, g_y, g_z;
+
+		void reserve(const int n);
+	};
+
+	// One scratch per OpenMP thread, so the neighbor loops never allocate
+	std::vector<NeighborhoodScratch> scratch;
 	
 	void InitSystem();
 	void SetParticlesColors();
+	NeighborhoodScratch& ThreadScratch();
+	void GatherRelativePositions(const Vec3Array& positions, const int target_index, const NeighborSpan& neighbors, NeighborhoodScratch& s) const;
 	Scalar CalcDensity(const int target_index);
-	Scalar CalcConstraint(const int target_index);
-	Vec3 CalcGradConstraint(const int target_index, const int var_index);
+	Scalar CalcLambda(const int target_index);
+	void ApplyXSPH();
+	void ApplyXSPHPairs();
 
 	void PrintAverageNumNeighbors();
 	void PrintAverageDensity();
 
 public:
-	PBF_System();
-	~PBF_System();
+	explicit PBF_SystemT(const int numParticles = 10800);
+	~PBF_SystemT();
 
-	inline const std::vector<PBF_Particle>& getParticles() const { return particles; }
+	inline PBF_ParticleViewT<T> getParticles() const { return PBF_ParticleViewT<T>(particles); }
 	inline int getNumParticles() const { return particles.size(); }
-	inline const PBF_Particle& getParticle(int index) const { return particles[index]; }
+	inline PBF_ParticleT<T> getParticle(int index) const { return particles.get(index); }
+	inline const ParticleData& getParticleData() const { return particles; }
+	inline int getNumSubSteps() const { return numSubSteps; }
+
+	// Cell key layout of the neighbor grid (Linear by default, Morton for A/B runs)
+	inline void setCellKeyMode(const CellKeyMode mode) { neighborSearchEngine.setKeyMode(mode); }
+	inline CellKeyMode getCellKeyMode() const { return neighborSearchEngine.getKeyMode(); }
+
+	// Densities and XSPH over half neighbor lists (each pair evaluated once).
+	// Off by default: the result is not bit-identical across thread counts
+	inline void setSymmetricPairs(const bool enabled) { symmetricPairs = enabled; }
+	inline bool getSymmetricPairs() const { return symmetricPairs; }
+
+	// Verlet neighbor lists: built with radius + skin and reused by the following steps
+	// until a particle has moved more than skin / 2 (0, the default, rebuilds every step).
+	// The rebuild rate is reported in PBF_StepTimings
+	inline void setNeighborSkin(const Scalar skin) { neighborSearchEngine.setSkin(skin); }
+	inline Scalar getNeighborSkin() const { return neighborSearchEngine.getSkin(); }
+	inline Scalar getKernelRadius() const { return radius; }
+
+	inline const PBF_StepTimings& getTimings() const { return timings; }
+	inline void resetTimings() { timings = PBF_StepTimings(); }
+
+	// Replaces the particle state (same number of particles), e.g. to start two runs from one state
+	void SetParticleData(const ParticleData& data);
 	
 	void AnimationStep();
 	void Step(const Scalar dt);
 private:
-};
\ No newline at end of file
+};
+
+using PBF_System = PBF_SystemT<Scalar>;
\ No newline at end of file
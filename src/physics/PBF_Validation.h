@@ -0,0 +1,44 @@
+// PBF_Validation.h
+#pragma once
+
+#include <vector>
+
+// Precision check for the CPU solver: PBF_SystemT<float> and PBF_SystemT<double>
+// are started from the same particle state and stepped side by side.
+// Per-particle errors grow over time (the flow is chaotic), so the pass/fail
+// decision is made on bulk quantities: center of mass and kinetic energy.
+struct PBF_PrecisionFrame
+{
+    int    frame;
+    double maxPositionError;     // max |x_float - x_double| over all particles
+    double rmsPositionError;
+    double centerOfMassError;    // |com_float - com_double|
+    double kineticEnergyError;   // |KE_float - KE_double| / KE_double
+    double floatFrameMs;
+    double doubleFrameMs;
+};
+
+struct PBF_PrecisionReport
+{
+    std::vector<PBF_PrecisionFrame> frames;
+    double tolerance = 0.0;      // allowed centerOfMassError, in world units
+    bool   passed = false;
+};
+
+PBF_PrecisionReport ComparePrecisions(const int num_frames, const double tolerance);
+
+void PrintPrecisionReport(const PBF_PrecisionReport& report);
+
+// Determinism check: the same state stepped with 1 thread and with every
+// available thread must end bit for bit identical (positions and velocities).
+struct PBF_DeterminismReport
+{
+    int  numFrames = 0;
+    int  numThreads = 0;         // thread count compared against the serial run
+    int  numMismatches = 0;      // particles whose x or v differ in any bit
+    bool passed = false;
+};
+
+PBF_DeterminismReport CheckThreadDeterminism(const int num_frames);
+
+void PrintDeterminismReport(const PBF_DeterminismReport& report);
@@ -18,6 +18,4 @@ struct Particle
 	float pres;
 
 	float surf_norm;
-
-	Particle* next;
 };
\ No newline at end of file
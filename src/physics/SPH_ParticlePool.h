@@ -0,0 +1,47 @@
+// SPH_ParticlePool.h
+#pragma once
+
+#include <cstdlib>
+#include <vector>
+
+#include "SPH_Particle.h"
+
+// Growable particle storage for SPH_System, in fixed-size chunks. Growing allocates new
+// chunks and never moves the particles already stored (no realloc copy), so a Particle*
+// stays valid while the pool grows. The pool only manages capacity: SPH_System keeps the
+// particles dense in [0, numParticles) and removes them by moving the last one into the hole.
+class SPH_ParticlePool
+{
+public:
+	static constexpr uint kChunkBits = 12;                 // 4096 particles per chunk
+	static constexpr uint kChunkSize = 1u << kChunkBits;
+
+	SPH_ParticlePool() = default;
+	~SPH_ParticlePool()
+	{
+		for (Particle* chunk : chunks)
+		{
+			free(chunk);
+		}
+	}
+
+	SPH_ParticlePool(const SPH_ParticlePool&) = delete;
+	SPH_ParticlePool& operator=(const SPH_ParticlePool&) = delete;
+
+	inline Particle& operator[](const uint i) { return chunks[i >> kChunkBits][i & (kChunkSize - 1)]; }
+	inline const Particle& operator[](const uint i) const { return chunks[i >> kChunkBits][i & (kChunkSize - 1)]; }
+
+	// Makes room for at least n particles
+	void reserve(const uint n)
+	{
+		while (capacity() < n)
+		{
+			chunks.push_back((Particle*) malloc(sizeof(Particle) * kChunkSize));
+		}
+	}
+
+	inline uint capacity() const { return uint(chunks.size()) << kChunkBits; }
+
+private:
+	std::vector<Particle*> chunks;
+};
@@ -1,8 +1,42 @@
 #include "SPH_System.h"
+#include "../support/Timer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+
+namespace
+{
+	// [begin, end) of the 'count' items that 'thread' owns in a static partition
+	inline std::pair<uint, uint> threadRange(const uint count, const int thread, const int num_threads)
+	{
+		const uint chunk = (count + num_threads - 1) / num_threads;
+		const uint begin = std::min(count, thread * chunk);
+		const uint end = std::min(count, begin + chunk);
+		return { begin, end };
+	}
+
+	// The block from entry k on
+	inline SphNeighborArrays offsetBlock(const SphNeighborArrays& nb, const uint k)
+	{
+		return { nb.p_x + k, nb.p_y + k, nb.p_z + k, nb.ev_x + k, nb.ev_y + k, nb.ev_z + k, nb.vol + k, nb.pres + k };
+	}
+
+	inline SphForceArrays offsetBlock(const SphForceArrays& out, const uint k)
+	{
+		return { out.acc_x + k, out.acc_y + k, out.acc_z + k, out.grad_x + k, out.grad_y + k, out.grad_z + k, out.lplc + k };
+	}
+
+	// Batch length up to a whole number of packs: the force kernels then run without a
+	// scalar tail, over the padding GatherRanges leaves after the block
+	inline uint roundToPacks(const uint n)
+	{
+		return (n + kSphPackWidth - 1) / kSphPackWidth * kSphPackWidth;
+	}
+}
 
 SPH_System::SPH_System()
 {
-	maxParticles = 30000;
 	numParticles = 0; 
 
 	kernel = 0.04f;
@@ -14,12 +48,7 @@ SPH_System::SPH_System()
 
 	cellSize = kernel;
 
-	gridSize = Eigen::Vector3i(
-		ceil(worldSize.x() / cellSize),
-		ceil(worldSize.y() / cellSize),
-		ceil(worldSize.z() / cellSize));
-
-	totCell = gridSize.x() * gridSize.y() * gridSize.z();
+	ResizeGrid();
 	
 	gravity = Eigen::Vector3f( 0.0f, -6.8f, 0.0f);
 
@@ -42,30 +71,35 @@ SPH_System::SPH_System()
 	self_dens = mass * poly6Value * pow(kernel, 6);
 	self_lplc_color = lplcPoly6 * mass * kernel_2 * (0 - 3 / 4 * kernel_2);
 
-	mem = (Particle*) malloc(sizeof(Particle) * maxParticles);
-	cell = (Particle**) malloc(sizeof(Particle*) * totCell);
+	pairCoeffs.h = kernel;
+	pairCoeffs.h_squared = kernel_2;
+	pairCoeffs.spiky = spikyValue;
+	pairCoeffs.visco = viscoValue;
+	pairCoeffs.grad_poly6 = gradPoly6;
+	pairCoeffs.lplc_poly6 = lplcPoly6;
+	pairCoeffs.viscosity = viscosity;
+
+	mem.reserve(30000);
 
 	sys_running = 0;
 
-	printf("Initialize SPH_System:\n");
-	printf("World Width : %f\n", worldSize.x());
-	printf("World Height: %f\n", worldSize.y());
-	printf("World Length: %f\n", worldSize.z());
-	printf("Cell Size  : %f\n", cellSize);
-	printf("Grid Width : %u\n", gridSize.x());
-	printf("Grid Height: %u\n", gridSize.y());
-	printf("Grid Length: %u\n", gridSize.z());
-	printf("Total Cell : %u\n", totCell);
-	printf("Poly6 Kernel: %f\n", poly6Value);
-	printf("Spiky Kernel: %f\n", spikyValue);
-	printf("Visco Kernel: %f\n", viscoValue);
-	printf("Self Density: %f\n", self_dens);
+	fprintf(stderr, "Initialize SPH_System:\n");
+	fprintf(stderr, "World Width : %f\n", worldSize.x());
+	fprintf(stderr, "World Height: %f\n", worldSize.y());
+	fprintf(stderr, "World Length: %f\n", worldSize.z());
+	fprintf(stderr, "Cell Size  : %f\n", cellSize);
+	fprintf(stderr, "Grid Width : %u\n", gridSize.x());
+	fprintf(stderr, "Grid Height: %u\n", gridSize.y());
+	fprintf(stderr, "Grid Length: %u\n", gridSize.z());
+	fprintf(stderr, "Total Cell : %u\n", totCell);
+	fprintf(stderr, "Poly6 Kernel: %f\n", poly6Value);
+	fprintf(stderr, "Spiky Kernel: %f\n", spikyValue);
+	fprintf(stderr, "Visco Kernel: %f\n", viscoValue);
+	fprintf(stderr, "Self Density: %f\n", self_dens);
 }
 
 SPH_System::~SPH_System()
 {
-	free(mem);
-	free(cell);
 }
 
 // Simulates a Step of simulation
@@ -76,10 +110,53 @@ void SPH_System::Animation()
 		return;
 	}
 
+	StageTimer timer;
+
+	EmitAndSink();
+	timer.lap(timings.emission);
+
 	BuildTable();
+	timer.lap(timings.buildTable);
+
 	Comp_DensPres();
-	Comp_ForceAdv();
+	timer.lap(timings.densPres);
+
+	if (symmetricPairs)
+	{
+		Comp_ForceAdvPairs();
+	}
+	else
+	{
+		Comp_ForceAdv();
+	}
+	timer.lap(timings.forceAdv);
+
 	Advection();
+	timer.lap(timings.advection);
+
+	timings.steps++;
+}
+
+void SPH_System::SetCellKeyMode(CellKeyMode mode)
+{
+	cellKeyMode = mode;
+	ResizeGrid();
+}
+
+// Grid covering worldSize with cellSize cells, in the current key layout
+void SPH_System::ResizeGrid()
+{
+	gridSize = Eigen::Vector3i(
+		ceil(worldSize.x() / cellSize),
+		ceil(worldSize.y() / cellSize),
+		ceil(worldSize.z() / cellSize));
+
+	activeKeyMode = cellkey::effectiveMode(cellKeyMode, gridSize.x(), gridSize.y(), gridSize.z());
+	totCell = cellkey::keyCount(activeKeyMode, gridSize.x(), gridSize.y(), gridSize.z());
+
+	// One extra cell (totCell) collects the particles outside the grid; no neighbor search visits it
+	cellStart.resize(totCell + 1);
+	cellEnd.resize(totCell + 1);
 }
 
 void SPH_System::InitSystem()
@@ -104,14 +181,51 @@ void SPH_System::InitSystem()
 		}
 	}
 
-	printf("Init Particle: %u\n", numParticles);
+	fprintf(stderr, "Init Particle: %u\n", numParticles);
+}
+
+// Spawns 'count' particles on a cube centered at 0,0,0 with the same spacing as InitSystem(),
+// so the solver can be run at a chosen problem size (the world grows when the cube does not fit)
+void SPH_System::InitSystem(uint count)
+{
+	const float spacing = kernel * 0.5f;
+	const uint side = uint(ceil(cbrt(double(count))));
+
+	const float required = spacing * float(side) + 2.0f * BOUNDARY;
+	if (worldSize.minCoeff() < required)
+	{
+		worldSize = worldSize.cwiseMax(Eigen::Vector3f::Constant(required));
+		ResizeGrid();
+		fprintf(stderr, "World grown to %f x %f x %f (%u cells)\n", worldSize.x(), worldSize.y(), worldSize.z(), totCell);
+	}
+
+	const float half = 0.5f * spacing * float(side - 1);
+
+	Eigen::Vector3f pos;
+	Eigen::Vector3f vel = Eigen::Vector3f(0.0f, 0.0f, 0.0f);
+
+	for (uint z = 0; z < side && numParticles < count; z++)
+	{
+		for (uint y = 0; y < side && numParticles < count; y++)
+		{
+			for (uint x = 0; x < side && numParticles < count; x++)
+			{
+				pos = Eigen::Vector3f(x * spacing - half, y * spacing - half, z * spacing - half);
+				AddParticle(pos, vel, Eigen::Vector3f(float(x) / side, float(y) / side, float(z) / side));
+			}
+		}
+	}
+
+	fprintf(stderr, "Init Particle: %u\n", numParticles);
 }
 
 void SPH_System::AddParticle(Eigen::Vector3f pos, Eigen::Vector3f vel)
 {
-	Particle *p = &(mem[numParticles]);
+	mem.reserve(numParticles + 1);
+
+	Particle* p = &(mem[numParticles]);
 
-	p->id = numParticles;
+	p->id = nextParticleId++;
 	p->pos = pos;
 	p->vel = vel;
 
@@ -122,17 +236,16 @@ void SPH_System::AddParticle(Eigen::Vector3f pos, Eigen::Vector3f vel)
 	p->dens = restDensity;
 	p->pres = 0.0f;
 
-	p->next = NULL;
-
 	numParticles++;
 }
 
 void SPH_System::AddParticle(Eigen::Vector3f pos, Eigen::Vector3f vel, Eigen::Vector3f col)
 {
+	mem.reserve(numParticles + 1);
 
 	Particle* p = &(mem[numParticles]);
 
-	p->id = numParticles;
+	p->id = nextParticleId++;
 	p->pos = pos;
 	p->vel = vel;
 
@@ -143,221 +256,519 @@ void SPH_System::AddParticle(Eigen::Vector3f pos, Eigen::Vector3f vel, Eigen::Ve
 	p->dens = restDensity;
 	p->pres = 0.0f;
 
-	p->next = NULL;
-
 	p->color = col;
 
 	numParticles++;
 }
 
-void SPH_System::BuildTable()
+// Swap-remove: keeps the particles dense in [0, numParticles) without shifting them
+void SPH_System::RemoveParticle(uint i)
 {
-	Particle* p;
-	uint hash;
+	if (i >= numParticles)
+	{
+		return;
+	}
 
-	for (uint i = 0; i < totCell; i++)
+	numParticles--;
+	if (i != numParticles)
 	{
-		cell[i] = NULL;
+		mem[i] = mem[numParticles];
 	}
+}
 
-	for (uint i = 0; i < numParticles; i++)
+uint SPH_System::AddEmitter(const SPH_Emitter& emitter)
+{
+	emitters.push_back(emitter);
+	return uint(emitters.size()) - 1;
+}
+
+void SPH_System::RemoveEmitter(uint index)
+{
+	if (index < emitters.size())
 	{
-		p = &(mem[i]);
-		hash = Calc_CellHash(Calc_CellPos(p->pos));
+		emitters[index] = emitters.back();
+		emitters.pop_back();
+	}
+}
+
+uint SPH_System::AddSink(const SPH_Sink& sink)
+{
+	sinks.push_back(sink);
+	return uint(sinks.size()) - 1;
+}
 
-		if (cell[hash] == NULL)
+void SPH_System::RemoveSink(uint index)
+{
+	if (index < sinks.size())
+	{
+		sinks[index] = sinks.back();
+		sinks.pop_back();
+	}
+}
+
+// Adds and removes particles before the step. Nothing else has to be updated: the pool grows
+// by chunks without moving particles, the cell arrays are sized by the world (not by the
+// particle count), and BuildTable sorts whatever particles exist at the start of the step.
+void SPH_System::EmitAndSink()
+{
+	const float spacing = kernel * 0.5f;
+	const Eigen::Vector3f boundary = worldSize * 0.5f - Eigen::Vector3f::Constant(BOUNDARY);
+
+	for (SPH_Emitter& emitter : emitters)
+	{
+		const uint side = std::max(1u, uint(emitter.size / spacing));
+		const float half = 0.5f * spacing * float(side - 1);
+
+		emitter.pending += emitter.rate * timeStep;
+		const uint count = uint(emitter.pending);
+		emitter.pending -= float(count);
+
+		mem.reserve(numParticles + count);
+
+		for (uint k = 0; k < count; k++)
 		{
-			p->next = NULL;
-			cell[hash] = p;
+			const uint slot = emitter.cursor++ % (side * side);
+
+			// As in a continuous stream, the particle has already travelled from the time it was
+			// due within this step, so two uses of a slot are vel * side^2 / rate apart (also
+			// when one step wraps around the lattice)
+			const float age = (float(count - 1 - k) + emitter.pending) / emitter.rate;
+
+			Eigen::Vector3f pos = emitter.pos + emitter.vel * age;
+			pos.x() += float(slot % side) * spacing - half;
+			pos.z() += float(slot / side) * spacing - half;
+			pos = pos.cwiseMax(-boundary).cwiseMin(boundary);
+
+			AddParticle(pos, emitter.vel, emitter.color);
+			mem[numParticles - 1].ev = emitter.vel;
 		}
-		else
+	}
+
+	if (sinks.empty())
+	{
+		return;
+	}
+
+	// From the back, so the particle swapped into a hole has already been tested
+	for (uint i = numParticles; i-- > 0; )
+	{
+		const Eigen::Vector3f& pos = mem[i].pos;
+
+		for (const SPH_Sink& sink : sinks)
 		{
-			p->next = cell[hash];
-			cell[hash] = p;
+			if ((pos.array() >= sink.min.array()).all() && (pos.array() <= sink.max.array()).all())
+			{
+				RemoveParticle(i);
+				break;
+			}
 		}
 	}
 }
 
-void SPH_System::Comp_DensPres()
+void SPH_System::BuildTable()
 {
-	Particle* p;
-	Particle* np;
-
-	Eigen::Vector3i cellPos;
-	Eigen::Vector3i nearPos;
-	uint hash;
+	cellKeys.resize(numParticles);
+	sortedIdx.resize(numParticles);
+	threadOffsets.resize(omp_get_max_threads() + 1);
+
+	sortedPosX.resize(numParticles);
+	sortedPosY.resize(numParticles);
+	sortedPosZ.resize(numParticles);
+	sortedEvX.resize(numParticles);
+	sortedEvY.resize(numParticles);
+	sortedEvZ.resize(numParticles);
+	sortedVol.resize(numParticles);
+	sortedPres.resize(numParticles);
+	if (symmetricPairs)
+	{
+		for (std::vector<float>* array : { &sortedAccX, &sortedAccY, &sortedAccZ, &sortedGradX, &sortedGradY, &sortedGradZ, &sortedLplc })
+		{
+			array->resize(numParticles);
+		}
+	}
+	scratch.resize(omp_get_max_threads());
+	for (NeighborScratch& s : scratch)
+	{
+		// A gathered block never holds more than the whole pool, so the passes never allocate
+		s.reserve(GetCapacity() + kSphPackWidth);
+	}
 
-	Eigen::Vector3f relPos;
-	float r2;
+	const uint numCells = totCell + 1;
 
-	for (uint i = 0; i < numParticles; i++)
+	#pragma omp parallel
 	{
-		p = &(mem[i]);
-		cellPos = Calc_CellPos(p->pos);
+		const int thread = omp_get_thread_num();
+		const int numThreads = omp_get_num_threads();
+		const auto [cellBegin, cellLast] = threadRange(numCells, thread, numThreads);
+
+		// 1. Cell of every particle + histogram (counts live in cellEnd for now)
+		std::fill(cellEnd.begin() + cellBegin, cellEnd.begin() + cellLast, 0u);
 
-		p->dens = 0.0f;
-		p->pres = 0.0f;
+		#pragma omp barrier
 
-		for (int x = -1; x <= 1; x++)
+		#pragma omp for
+		for (int i = 0; i < (int)numParticles; i++)
 		{
-			for (int y = -1; y <= 1; y++)
+			uint hash = Calc_CellHash(Calc_CellPos(mem[i].pos));
+			if (hash == 0xffffffff)
 			{
-				for (int z = -1; z <= 1; z++)
-				{
-					nearPos.x() = cellPos.x() + x;
-					nearPos.y() = cellPos.y() + y;
-					nearPos.z() = cellPos.z() + z;
-					hash = Calc_CellHash(nearPos);
+				hash = totCell;
+			}
+			cellKeys[i] = hash;
 
-					if (hash == 0xffffffff)
-					{
-						continue;
-					}
+			#pragma omp atomic
+			++cellEnd[hash];
+		}
 
-					np = cell[hash];
-					while (np != NULL)
-					{
-						relPos.x() = np->pos.x() - p->pos.x();
-						relPos.y() = np->pos.y() - p->pos.y();
-						relPos.z() = np->pos.z() - p->pos.z();
-						r2 = relPos.x() * relPos.x() + relPos.y() * relPos.y() + relPos.z() * relPos.z();
+		// 2. Exclusive prefix sum -> first slot of every cell (local scan, scan of block sums, fix-up)
+		uint offset = 0;
+		for (uint c = cellBegin; c < cellLast; c++)
+		{
+			cellStart[c] = offset;
+			offset += cellEnd[c];
+		}
+		threadOffsets[thread + 1] = offset;
+
+		#pragma omp barrier
+
+		#pragma omp single
+		{
+			threadOffsets[0] = 0;
+			for (int t = 0; t < numThreads; t++)
+			{
+				threadOffsets[t + 1] += threadOffsets[t];
+			}
+		}
 
-						if (r2 < INF || r2 >= kernel_2)
-						{
-							np = np->next;
-							continue;
-						}
+		for (uint c = cellBegin; c < cellLast; c++)
+		{
+			cellStart[c] += threadOffsets[thread];
+			cellEnd[c] = cellStart[c];
+		}
 
-						p->dens = p->dens + mass * poly6Value * pow(kernel_2 - r2, 3);
+		#pragma omp barrier
 
-						np = np->next;
-					}
-				}
+		// 3. Scatter: cellEnd is the write cursor and ends one past the last slot
+		#pragma omp for
+		for (int i = 0; i < (int)numParticles; i++)
+		{
+			uint slot;
+
+			#pragma omp atomic capture
+			slot = cellEnd[cellKeys[i]]++;
+
+			sortedIdx[slot] = i;
+		}
+
+		// 4. Sort the (tiny) cell ranges so the order, and the results, do not depend on the threads
+		#pragma omp for schedule(static)
+		for (int c = 0; c < (int)numCells; c++)
+		{
+			if (cellEnd[c] - cellStart[c] > 1)
+			{
+				std::sort(sortedIdx.begin() + cellStart[c], sortedIdx.begin() + cellEnd[c]);
 			}
 		}
 
-		p->dens = p->dens + self_dens;
-		p->pres = (pow(p->dens / restDensity, 7) - 1) * gasConstant;
+		// 5. SoA copy of what the neighbor passes read, in slot order, so that every cell row
+		//    is a contiguous block for the packed pair kernels
+		#pragma omp for schedule(static)
+		for (int s = 0; s < (int)numParticles; s++)
+		{
+			const Particle& p = mem[sortedIdx[s]];
+			sortedPosX[s] = p.pos.x();
+			sortedPosY[s] = p.pos.y();
+			sortedPosZ[s] = p.pos.z();
+			sortedEvX[s] = p.ev.x();
+			sortedEvY[s] = p.ev.y();
+			sortedEvZ[s] = p.ev.z();
+		}
 	}
 }
 
-void SPH_System::Comp_ForceAdv()
+// Copies the candidate neighbors of a particle at 'pos' (its 3x3x3 cells) from the sorted
+// arrays into the thread scratch, as one block for the pair kernels. Positions only for the
+// density pass, everything for the force pass.
+uint SPH_System::GatherNeighbors(const Eigen::Vector3f& pos, const bool forceData, SphNeighborArrays& nb)
 {
-	Particle* p;
-	Particle* np;
+	uint rangeBegin[27];
+	uint rangeEnd[27];
+	const uint numRanges = Calc_NearRanges(Calc_CellPos(pos), rangeBegin, rangeEnd);
 
-	Eigen::Vector3i cell_pos;
-	Eigen::Vector3i near_pos;
-	uint hash;
+	return GatherRanges(rangeBegin, rangeEnd, numRanges, forceData, nb);
+}
 
-	Eigen::Vector3f relPos;
-	Eigen::Vector3f relVel;
+// Grows only
+void SPH_System::NeighborScratch::reserve(const uint n)
+{
+	if (p_x.size() < n)
+	{
+		for (std::vector<float>* array : { &p_x, &p_y, &p_z, &ev_x, &ev_y, &ev_z, &vol, &pres,
+		                                   &acc_x, &acc_y, &acc_z, &grad_x, &grad_y, &grad_z, &lplc })
+		{
+			array->resize(n);
+		}
+	}
+}
 
-	float r2;
-	float r;
-	float kernel_r;
-	float V;
+// Copies the slot ranges [rangeBegin[n], rangeEnd[n]) one after the other into the thread scratch
+uint SPH_System::GatherRanges(const uint* rangeBegin, const uint* rangeEnd, const uint numRanges, const bool forceData, SphNeighborArrays& nb)
+{
+	NeighborScratch& s = scratch[omp_get_thread_num()];
+
+	uint count = 0;
+	for (uint n = 0; n < numRanges; n++)
+	{
+		count += rangeEnd[n] - rangeBegin[n];
+	}
+
+	s.reserve(count + kSphPackWidth);
+
+	uint k = 0;
+	for (uint n = 0; n < numRanges; n++)
+	{
+		const uint first = rangeBegin[n];
+		const uint size = rangeEnd[n] - first;
+
+		std::copy_n(&sortedPosX[first], size, &s.p_x[k]);
+		std::copy_n(&sortedPosY[first], size, &s.p_y[k]);
+		std::copy_n(&sortedPosZ[first], size, &s.p_z[k]);
+
+		if (forceData)
+		{
+			std::copy_n(&sortedEvX[first], size, &s.ev_x[k]);
+			std::copy_n(&sortedEvY[first], size, &s.ev_y[k]);
+			std::copy_n(&sortedEvZ[first], size, &s.ev_z[k]);
+			std::copy_n(&sortedVol[first], size, &s.vol[k]);
+			std::copy_n(&sortedPres[first], size, &s.pres[k]);
+		}
+
+		k += size;
+	}
+
+	// One pack of padding: far away and without volume, so a batch can end on a whole pack
+	std::fill_n(&s.p_x[count], kSphPackWidth, 1e10f);
+	std::fill_n(&s.p_y[count], kSphPackWidth, 0.0f);
+	std::fill_n(&s.p_z[count], kSphPackWidth, 0.0f);
+	if (forceData)
+	{
+		for (std::vector<float>* array : { &s.ev_x, &s.ev_y, &s.ev_z, &s.vol, &s.pres })
+		{
+			std::fill_n(&(*array)[count], kSphPackWidth, 0.0f);
+		}
+	}
 
-	float presKernel;
-	float viscKernel;
-	float tempForce;
+	nb = { s.p_x.data(), s.p_y.data(), s.p_z.data(),
+	       s.ev_x.data(), s.ev_y.data(), s.ev_z.data(),
+	       s.vol.data(), s.pres.data() };
+	return count;
+}
 
-	Eigen::Vector3f gradColor;
-	float lplcColor;
+// Both neighbor passes go cell by cell: the particles of a cell share their 3x3x3
+// neighborhood, so it is gathered once per cell and each particle runs the packed kernels
+// of SphPairKernels.h (no libm call per pair) over it. Each particle only writes its own
+// fields; the ones outside the grid (cell totCell) gather their own neighborhood.
+void SPH_System::Comp_DensPres()
+{
+	const uint* idx = sortedIdx.data();
 
-	for (uint i = 0; i < numParticles; i++)
+	#pragma omp parallel for schedule(dynamic, 16)
+	for (int c = 0; c < (int)totCell + 1; c++)
 	{
-		p = &(mem[i]);
-		cell_pos = Calc_CellPos(p->pos);
+		SphNeighborArrays nb;
+		uint numNeighbors = 0;
 
-		p->acc.x() = 0.0f;
-		p->acc.y() = 0.0f;
-		p->acc.z() = 0.0f;
+		for (uint s = cellStart[c]; s < cellEnd[c]; s++)
+		{
+			Particle* p = &(mem[idx[s]]);
 
-		gradColor.x() = 0.0f;
-		gradColor.y() = 0.0f;
-		gradColor.z() = 0.0f;
-		lplcColor = 0.0f;
+			if (s == cellStart[c] || c == (int)totCell)
+			{
+				numNeighbors = GatherNeighbors(p->pos, false, nb);
+			}
 
-		for (int x = -1; x <= 1; x++)
+			// Inside the grid the particle is part of its own block and adds self_dens to the sum;
+			// outside it (cell totCell, never gathered) it is not, so self_dens is added here
+			p->dens = mass * poly6Value * sumDensityBatch(pairCoeffs, p->pos.data(), nb, numNeighbors);
+			if (c == (int)totCell)
+			{
+				p->dens += self_dens;
+			}
+
+			// (dens / restDensity)^7 with multiplications
+			const float ratio = p->dens / restDensity;
+			const float ratio_3 = ratio * ratio * ratio;
+			p->pres = (ratio_3 * ratio_3 * ratio - 1.0f) * gasConstant;
+
+			sortedVol[s] = mass / p->dens / 2;
+			sortedPres[s] = p->pres;
+		}
+	}
+}
+
+void SPH_System::Comp_ForceAdv()
+{
+	const uint* idx = sortedIdx.data();
+
+	#pragma omp parallel for schedule(dynamic, 16)
+	for (int c = 0; c < (int)totCell + 1; c++)
+	{
+		SphNeighborArrays nb;
+		uint numNeighbors = 0;
+
+		for (uint s = cellStart[c]; s < cellEnd[c]; s++)
 		{
-			for (int y = -1; y <= 1; y++)
+			Particle* p = &(mem[idx[s]]);
+
+			if (s == cellStart[c] || c == (int)totCell)
 			{
-				for (int z = -1; z <= 1; z++)
+				numNeighbors = GatherNeighbors(p->pos, true, nb);
+			}
+
+			ApplyForce(p, sumForceBatch(pairCoeffs, p->pos.data(), p->ev.data(), p->pres, nb, roundToPacks(numNeighbors)));
+		}
+	}
+}
+
+// Symmetric force pass: each pair is evaluated once. A cell pairs its particles with each
+// other and with the 13 cells ahead of it (Calc_HalfRanges), and the reactions are added to
+// the partners, i.e. to the cells x-1..x+1, y-1..y+1, z..z+1. Cells are processed in 18
+// colors (x mod 3, y mod 3, z mod 2) so that no two cells of a color write the same slots:
+// no atomics, and the sums do not depend on the threads. Particles outside the grid are not
+// in anyone's neighborhood and keep the one-sided sums.
+void SPH_System::Comp_ForceAdvPairs()
+{
+	const uint* idx = sortedIdx.data();
+	const uint numGridSlots = cellStart[totCell];
+
+	#pragma omp parallel
+	{
+		NeighborScratch& sc = scratch[omp_get_thread_num()];
+
+		#pragma omp for schedule(static)
+		for (int s = 0; s < (int)numGridSlots; s++)
+		{
+			sortedAccX[s] = sortedAccY[s] = sortedAccZ[s] = 0.0f;
+			sortedGradX[s] = sortedGradY[s] = sortedGradZ[s] = 0.0f;
+			sortedLplc[s] = 0.0f;
+		}
+
+		for (int color = 0; color < 18; color++)
+		{
+			const int cx = color % 3;
+			const int cy = color / 3 % 3;
+			const int cz = color / 9;
+			const int nx = (gridSize.x() - cx + 2) / 3;
+			const int ny = (gridSize.y() - cy + 2) / 3;
+			const int nz = (gridSize.z() - cz + 1) / 2;
+
+			#pragma omp for schedule(dynamic, 16)
+			for (int m = 0; m < nx * ny * nz; m++)
+			{
+				const Eigen::Vector3i cellPos(cx + 3 * (m % nx), cy + 3 * (m / nx % ny), cz + 2 * (m / (nx * ny)));
+
+				uint rangeBegin[14];
+				uint rangeEnd[14];
+				const uint numRanges = Calc_HalfRanges(cellPos, rangeBegin, rangeEnd);
+				const uint numHome = rangeEnd[0] - rangeBegin[0];
+				if (numHome == 0)
 				{
-					near_pos.x() = cell_pos.x() + x;
-					near_pos.y() = cell_pos.y() + y;
-					near_pos.z() = cell_pos.z() + z;
-					hash = Calc_CellHash(near_pos);
+					continue;
+				}
 
-					if (hash == 0xffffffff)
-					{
-						continue;
-					}
+				SphNeighborArrays nb;
+				const uint count = GatherRanges(rangeBegin, rangeEnd, numRanges, true, nb);
 
-					np = cell[hash];
-					while (np != NULL)
+				const SphForceArrays out = { sc.acc_x.data(), sc.acc_y.data(), sc.acc_z.data(),
+				                             sc.grad_x.data(), sc.grad_y.data(), sc.grad_z.data(), sc.lplc.data() };
+				for (float* array : { out.acc_x, out.acc_y, out.acc_z, out.grad_x, out.grad_y, out.grad_z, out.lplc })
+				{
+					std::fill_n(array, count, 0.0f);
+				}
+
+				// The block starts with the home cell: particle a pairs with the entries after it,
+				// up to a whole number of packs (the padding adds nothing)
+				for (uint a = 0; a < numHome; a++)
+				{
+					const uint s = rangeBegin[0] + a;
+					const float pos[3] = { nb.p_x[a], nb.p_y[a], nb.p_z[a] };
+					const float ev[3] = { nb.ev_x[a], nb.ev_y[a], nb.ev_z[a] };
+
+					const SphForceSums sums = sumForcePairsBatch(pairCoeffs, pos, ev, sortedPres[s], sortedVol[s],
+					                                             offsetBlock(nb, a + 1), roundToPacks(count - a - 1), offsetBlock(out, a + 1));
+					out.acc_x[a] += sums.acc_x;
+					out.acc_y[a] += sums.acc_y;
+					out.acc_z[a] += sums.acc_z;
+					out.grad_x[a] += sums.grad_x;
+					out.grad_y[a] += sums.grad_y;
+					out.grad_z[a] += sums.grad_z;
+					out.lplc[a] += sums.lplc;
+				}
+
+				uint k = 0;
+				for (uint n = 0; n < numRanges; n++)
+				{
+					for (uint s = rangeBegin[n]; s < rangeEnd[n]; s++, k++)
 					{
-						relPos.x() = p->pos.x() - np->pos.x();
-						relPos.y() = p->pos.y() - np->pos.y();
-						relPos.z() = p->pos.z() - np->pos.z();
-						r2 = relPos.x() * relPos.x() + relPos.y() * relPos.y() + relPos.z() * relPos.z();
-
-						if (r2 < kernel_2 && r2 > INF)
-						{
-							r = sqrt(r2);
-							V = mass / np->dens / 2;
-							kernel_r = kernel - r;
-
-							presKernel = spikyValue * kernel_r * kernel_r;
-							tempForce = V * (p->pres + np->pres) * presKernel;
-
-							p->acc.x() = p->acc.x() - relPos.x() * tempForce / r;
-							p->acc.y() = p->acc.y() - relPos.y() * tempForce / r;
-							p->acc.z() = p->acc.z() - relPos.z() * tempForce / r;
-
-							relVel.x() = np->ev.x() - p->ev.x();
-							relVel.y() = np->ev.y() - p->ev.y();
-							relVel.z() = np->ev.z() - p->ev.z();
-
-							viscKernel = viscoValue * (kernel - r);
-							tempForce = V * viscosity * viscKernel;
-							p->acc.x() = p->acc.x() + relVel.x() * tempForce;
-							p->acc.y() = p->acc.y() + relVel.y() * tempForce;
-							p->acc.z() = p->acc.z() + relVel.z() * tempForce;
-
-							float temp = (-1) * gradPoly6 * V * pow(kernel_2 - r2, 2);
-							gradColor.x() += temp * relPos.x();
-							gradColor.y() += temp * relPos.y();
-							gradColor.z() += temp * relPos.z();
-							lplcColor += lplcPoly6 * V * (kernel_2 - r2) * (r2 - 3 / 4 * (kernel_2 - r2));
-						}
-
-						np = np->next;
+						sortedAccX[s] += out.acc_x[k];
+						sortedAccY[s] += out.acc_y[k];
+						sortedAccZ[s] += out.acc_z[k];
+						sortedGradX[s] += out.grad_x[k];
+						sortedGradY[s] += out.grad_y[k];
+						sortedGradZ[s] += out.grad_z[k];
+						sortedLplc[s] += out.lplc[k];
 					}
 				}
 			}
 		}
 
-		lplcColor += self_lplc_color / p->dens;
-		p->surf_norm = sqrt(gradColor.x() * gradColor.x() + gradColor.y() * gradColor.y() + gradColor.z() * gradColor.z());
+		#pragma omp for schedule(static) nowait
+		for (int s = 0; s < (int)numGridSlots; s++)
+		{
+			SphForceSums sums;
+			sums.acc_x = sortedAccX[s];
+			sums.acc_y = sortedAccY[s];
+			sums.acc_z = sortedAccZ[s];
+			sums.grad_x = sortedGradX[s];
+			sums.grad_y = sortedGradY[s];
+			sums.grad_z = sortedGradZ[s];
+			sums.lplc = sortedLplc[s];
+			ApplyForce(&(mem[idx[s]]), sums);
+		}
 
-		if (p->surf_norm > surfNorm)
+		#pragma omp for schedule(dynamic, 16)
+		for (int s = (int)numGridSlots; s < (int)numParticles; s++)
 		{
-			p->acc.x() += surfCoe * lplcColor * gradColor.x() / p->surf_norm;
-			p->acc.y() += surfCoe * lplcColor * gradColor.y() / p->surf_norm;
-			p->acc.z() += surfCoe * lplcColor * gradColor.z() / p->surf_norm;
+			Particle* p = &(mem[idx[s]]);
+
+			SphNeighborArrays nb;
+			const uint numNeighbors = GatherNeighbors(p->pos, true, nb);
+			ApplyForce(p, sumForceBatch(pairCoeffs, p->pos.data(), p->ev.data(), p->pres, nb, roundToPacks(numNeighbors)));
 		}
 	}
 }
 
-void SPH_System::Advection()
+// Acceleration from the pair sums of a particle, plus surface tension
+void SPH_System::ApplyForce(Particle* p, const SphForceSums& sums) const
 {
-	Particle* p;
+	p->acc = Eigen::Vector3f(sums.acc_x, sums.acc_y, sums.acc_z);
+
+	const Eigen::Vector3f gradColor(sums.grad_x, sums.grad_y, sums.grad_z);
+	const float lplcColor = sums.lplc + self_lplc_color / p->dens;
+	p->surf_norm = gradColor.norm();
+
+	if (p->surf_norm > surfNorm)
+	{
+		p->acc += surfCoe * lplcColor * gradColor / p->surf_norm;
+	}
+}
 
-	for (uint i = 0; i < numParticles; i++)
+void SPH_System::Advection()
+{
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < (int)numParticles; i++)
 	{
-		p = &(mem[i]);
+		Particle* p = &(mem[i]);
 
 		p->vel.x() = p->vel.x() + p->acc.x() * timeStep / p->dens + gravity.x() * timeStep;
 		p->vel.y() = p->vel.y() + p->acc.y() * timeStep / p->dens + gravity.y() * timeStep;
@@ -429,10 +840,100 @@ uint SPH_System::Calc_CellHash(Eigen::Vector3i cellPos)
 		return (uint)0xffffffff;
 	}
 
-	cellPos.x() = cellPos.x() & (gridSize.x() - 1);
-	cellPos.y() = cellPos.y() & (gridSize.y() - 1);
-	cellPos.z() = cellPos.z() & (gridSize.z() - 1);
+	return cellkey::encode(activeKeyMode, cellPos.x(), cellPos.y(), cellPos.z(), gridSize.x(), gridSize.y());
+
+}
+
+// Slot ranges of sortedIdx covering the 3x3x3 cells around cellPos (at most 27). With Linear
+// keys the cells x-1..x+1 of a row are consecutive, so each row is a single range (at most 9).
+uint SPH_System::Calc_NearRanges(const Eigen::Vector3i& cellPos, uint* begin, uint* end) const
+{
+	uint numRanges = 0;
 
-	return ((uint)(cellPos.z())) * gridSize.y() * gridSize.x() + ((uint)(cellPos.y())) * gridSize.x() + (uint)(cellPos.x());
+	for (int z = cellPos.z() - 1; z <= cellPos.z() + 1; z++)
+	{
+		if (z < 0 || z >= gridSize.z())
+		{
+			continue;
+		}
 
-}
\ No newline at end of file
+		for (int y = cellPos.y() - 1; y <= cellPos.y() + 1; y++)
+		{
+			if (y < 0 || y >= gridSize.y())
+			{
+				continue;
+			}
+
+			const int xMin = std::max(cellPos.x() - 1, 0);
+			const int xMax = std::min(cellPos.x() + 1, gridSize.x() - 1);
+
+			if (activeKeyMode == CellKeyMode::Linear)
+			{
+				if (xMin <= xMax)
+				{
+					begin[numRanges] = cellStart[cellkey::linear(xMin, y, z, gridSize.x(), gridSize.y())];
+					end[numRanges] = cellEnd[cellkey::linear(xMax, y, z, gridSize.x(), gridSize.y())];
+					numRanges++;
+				}
+				continue;
+			}
+
+			for (int x = xMin; x <= xMax; x++)
+			{
+				const uint hash = cellkey::encode(activeKeyMode, x, y, z, gridSize.x(), gridSize.y());
+				begin[numRanges] = cellStart[hash];
+				end[numRanges] = cellEnd[hash];
+				numRanges++;
+			}
+		}
+	}
+
+	return numRanges;
+}
+// Half of the 3x3x3 neighborhood of cellPos for the symmetric force pass: the cell itself
+// (always the first range, possibly empty) and the 13 cells after it in (z, y, x) order,
+// i.e. x+1 of its row, row y+1 of its plane and the 9 cells of plane z+1. Each pair of
+// neighboring cells is thus visited from exactly one side. At most 14 ranges.
+uint SPH_System::Calc_HalfRanges(const Eigen::Vector3i& cellPos, uint* begin, uint* end) const
+{
+	const uint home = cellkey::encode(activeKeyMode, cellPos.x(), cellPos.y(), cellPos.z(), gridSize.x(), gridSize.y());
+	begin[0] = cellStart[home];
+	end[0] = cellEnd[home];
+	uint numRanges = 1;
+
+	// Cells x0..x1 of row (y, z), one range per row with Linear keys
+	auto addRow = [&](const int x0, const int x1, const int y, const int z)
+	{
+		const int xMin = std::max(x0, 0);
+		const int xMax = std::min(x1, gridSize.x() - 1);
+		if (y < 0 || y >= gridSize.y() || z >= gridSize.z() || xMin > xMax)
+		{
+			return;
+		}
+
+		if (activeKeyMode == CellKeyMode::Linear)
+		{
+			begin[numRanges] = cellStart[cellkey::linear(xMin, y, z, gridSize.x(), gridSize.y())];
+			end[numRanges] = cellEnd[cellkey::linear(xMax, y, z, gridSize.x(), gridSize.y())];
+			numRanges++;
+			return;
+		}
+
+		for (int x = xMin; x <= xMax; x++)
+		{
+			const uint hash = cellkey::encode(activeKeyMode, x, y, z, gridSize.x(), gridSize.y());
+			begin[numRanges] = cellStart[hash];
+			end[numRanges] = cellEnd[hash];
+			numRanges++;
+		}
+	};
+
+	addRow(cellPos.x() + 1, cellPos.x() + 1, cellPos.y(), cellPos.z());
+	addRow(cellPos.x() - 1, cellPos.x() + 1, cellPos.y() + 1, cellPos.z());
+	for (int y = cellPos.y() - 1; y <= cellPos.y() + 1; y++)
+	{
+		addRow(cellPos.x() - 1, cellPos.x() + 1, y, cellPos.z() + 1);
+	}
+
+	return numRanges;
+}
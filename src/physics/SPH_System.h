@@ -1,20 +1,61 @@
 #pragma once
 
+#include <vector>
+
 #include "SPH_Particle.h"
+#include "SPH_ParticlePool.h"
 #include "../support/Common.h"
+#include "maths/CellKey.h"
+#include "maths/SphPairKernels.h"
+
+// Accumulated wall time of each stage of SPH_System::Animation, in milliseconds
+struct SPH_StepTimings
+{
+	double emission = 0.0;       // emitters and sinks
+	double buildTable = 0.0;     // neighbor search (cell lists)
+	double densPres = 0.0;
+	double forceAdv = 0.0;
+	double advection = 0.0;
+	int    steps = 0;
+
+	inline double total() const { return emission + buildTable + densPres + forceAdv + advection; }
+};
+
+// Spawns particles while the simulation runs: 'rate' particles per second with velocity
+// 'vel', cycling over the h/2 lattice points of a size x size square (XZ plane) centred at pos.
+// Each particle starts where the stream has carried it since it was due, so the particles of
+// one lattice point are as far apart as the stream travels in a lattice period (vel = 0 stacks them)
+struct SPH_Emitter
+{
+	Eigen::Vector3f pos = Eigen::Vector3f::Zero();
+	Eigen::Vector3f vel = Eigen::Vector3f::Zero();
+	Eigen::Vector3f color = Eigen::Vector3f(0.2f, 0.4f, 1.0f);
+	float size = 0.08f;
+	float rate = 1000.0f;
+
+	float pending = 0.0f;        // fraction of a particle carried to the next step
+	uint  cursor = 0;            // next lattice point
+};
+
+// Removes the particles that enter the box [min, max]
+struct SPH_Sink
+{
+	Eigen::Vector3f min = Eigen::Vector3f::Zero();
+	Eigen::Vector3f max = Eigen::Vector3f::Zero();
+};
 
 class SPH_System
 {
 private:
-	uint maxParticles;
-
 	float kernel;
 	float mass;
 
 	Eigen::Vector3f worldSize;
 	float cellSize;
 	Eigen::Vector3i gridSize;
-	uint totCell;
+	uint totCell;                  // number of cell keys (see CellKey.h)
+	CellKeyMode cellKeyMode = CellKeyMode::Linear;     // requested layout
+	CellKeyMode activeKeyMode = CellKeyMode::Linear;   // layout of the current grid (see cellkey::effectiveMode)
 
 	Eigen::Vector3f gravity;
 	float wallDamping;
@@ -36,28 +77,105 @@ private:
 	float self_dens;
 	float self_lplc_color;
 
-	
-	Particle** cell;
+	SphPairCoefficients pairCoeffs;
+
+	// Counting-sort cell layout (as HashGridT / cellStart-cellEnd on the GPU), rebuilt by BuildTable
+	std::vector<uint> cellKeys;        // cell of each particle (totCell outside the grid)
+	std::vector<uint> cellStart;       // first slot of each cell in sortedIdx
+	std::vector<uint> cellEnd;         // one past the last slot of each cell
+	std::vector<uint> sortedIdx;       // particle indices ordered by cell
+	std::vector<uint> threadOffsets;   // per-thread block sums of the cell prefix scan
+
+	// Neighbor data in slot order (SoA), read by the pair kernels: position and ev are
+	// gathered by BuildTable, volume (mass / dens / 2) and pressure by Comp_DensPres
+	std::vector<float> sortedPosX, sortedPosY, sortedPosZ;
+	std::vector<float> sortedEvX, sortedEvY, sortedEvZ;
+	std::vector<float> sortedVol;
+	std::vector<float> sortedPres;
+
+	// Force sums in slot order, accumulated from both sides of each pair by Comp_ForceAdvPairs
+	std::vector<float> sortedAccX, sortedAccY, sortedAccZ;
+	std::vector<float> sortedGradX, sortedGradY, sortedGradZ;
+	std::vector<float> sortedLplc;
+	bool symmetricPairs = false;
+
+	// 3x3x3 neighborhood of one cell gathered into a single block. One per OpenMP thread,
+	// so the neighbor passes never allocate
+	struct NeighborScratch
+	{
+		std::vector<float> p_x, p_y, p_z;
+		std::vector<float> ev_x, ev_y, ev_z;
+		std::vector<float> vol, pres;
+
+		// Reactions of the block in the symmetric force pass
+		std::vector<float> acc_x, acc_y, acc_z;
+		std::vector<float> grad_x, grad_y, grad_z;
+		std::vector<float> lplc;
+
+		void reserve(const uint n);
+	};
+	std::vector<NeighborScratch> scratch;
+
+	SPH_StepTimings timings;
+
+	std::vector<SPH_Emitter> emitters;
+	std::vector<SPH_Sink> sinks;
+	uint nextParticleId = 0;
 
 public:
 	SPH_System();
 	~SPH_System();
 	void Animation();
 	void InitSystem();
+	void InitSystem(uint count);
 	void AddParticle(Eigen::Vector3f pos, Eigen::Vector3f vel);
-	void SPH_System::AddParticle(Eigen::Vector3f pos, Eigen::Vector3f vel, Eigen::Vector3f col);
+	void AddParticle(Eigen::Vector3f pos, Eigen::Vector3f vel, Eigen::Vector3f col);
+
+	inline const SPH_StepTimings& GetTimings() const { return timings; }
+	inline void ResetTimings() { timings = SPH_StepTimings(); }
 
-	Particle* mem;
+	void SetCellKeyMode(CellKeyMode mode);
+	inline CellKeyMode GetCellKeyMode() const { return cellKeyMode; }
+	inline CellKeyMode GetActiveKeyMode() const { return activeKeyMode; }
+
+	// Force pass over half neighbor lists (each pair evaluated once) instead of full ones
+	inline void SetSymmetricPairs(bool enabled) { symmetricPairs = enabled; }
+	inline bool GetSymmetricPairs() const { return symmetricPairs; }
+
+	// Emitters and sinks run at the start of every step; indices stay valid until the
+	// entry is removed (the last one moves into its place)
+	uint AddEmitter(const SPH_Emitter& emitter);
+	void RemoveEmitter(uint index);
+	inline std::vector<SPH_Emitter>& GetEmitters() { return emitters; }
+
+	uint AddSink(const SPH_Sink& sink);
+	void RemoveSink(uint index);
+	inline std::vector<SPH_Sink>& GetSinks() { return sinks; }
+
+	// Removes particle i; the last particle takes its index
+	void RemoveParticle(uint i);
+	inline uint GetCapacity() const { return mem.capacity(); }
+
+	SPH_ParticlePool mem;
 	uint numParticles;
 
 	uint sys_running;
 
 private:
+	void EmitAndSink();
 	void BuildTable();
 	void Comp_DensPres();
 	void Comp_ForceAdv();
+	void Comp_ForceAdvPairs();
+	void ApplyForce(Particle* p, const SphForceSums& sums) const;
 	void Advection();
 
+	void ResizeGrid();
+	uint GatherNeighbors(const Eigen::Vector3f& pos, const bool forceData, SphNeighborArrays& nb);
+	uint GatherRanges(const uint* rangeBegin, const uint* rangeEnd, const uint numRanges, const bool forceData, SphNeighborArrays& nb);
+
 	Eigen::Vector3i Calc_CellPos(Eigen::Vector3f p);
 	uint Calc_CellHash(Eigen::Vector3i cellPos);
+	uint Calc_NearRanges(const Eigen::Vector3i& cellPos, uint* begin, uint* end) const;
+	uint Calc_HalfRanges(const Eigen::Vector3i& cellPos, uint* begin, uint* end) const;
 };
\ No newline at end of file
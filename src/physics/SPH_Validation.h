@@ -0,0 +1,26 @@
+// SPH_Validation.h
+#pragma once
+
+// Density of a particle outside the grid: it sits in the extra cell (totCell) that no
+// neighbor search gathers, so its own contribution (self_dens) is added explicitly.
+// It must match a particle alone inside the grid, whose gathered block holds itself.
+struct SPH_StrayDensityReport
+{
+    float strayDensity = 0.0f;
+    float isolatedDensity = 0.0f;    // self_dens
+    bool  passed = false;
+};
+
+SPH_StrayDensityReport CheckStrayDensity();
+
+// Emitter spacing: a stream that wraps around its lattice within every step must not place
+// two particles on the same point (the lattice spacing is h/2 = 0.02).
+struct SPH_EmitterReport
+{
+    int   numSteps = 0;
+    int   numParticles = 0;
+    float minDistance = 0.0f;        // closest pair of particles over all the steps
+    bool  passed = false;
+};
+
+SPH_EmitterReport CheckEmitterSpacing(const int num_steps);
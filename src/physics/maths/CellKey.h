@@ -0,0 +1,98 @@
+// CellKey.h
+#pragma once
+
+#include <cstdint>
+
+// How integer cell coordinates are flattened into the keys that the uniform grids
+// sort by and index their cell arrays with.
+//  - Linear: x + y * X + z * X * Y (row-major).
+//  - Morton: the bits of x, y and z interleaved (Z-order curve), so cells that are
+//    close in space get close keys and, once sorted, close memory.
+//  - Hashed: spatial hash of the (unbounded) cell coordinates into a fixed table sized
+//    from the particle count. PBF_GPU_System and HashGridT implement it (HashGridT also
+//    falls back to it when a dense grid would be too large); SPH_System uses Linear.
+// AssignCells.comp and the neighbor shaders implement the same encodings (uKeyMode).
+enum class CellKeyMode
+{
+    Linear = 0,
+    Morton = 1,
+    Hashed = 2,
+};
+
+namespace cellkey
+{
+    // Morton keys use 10 bits per axis (30-bit keys)
+    constexpr int      kMortonAxisBits = 10;
+    constexpr uint32_t kMortonAxisCells = 1u << kMortonAxisBits;
+
+    // Spreads the low 10 bits of v so that there are two zero bits between each of them
+    inline uint32_t part1By2(uint32_t v)
+    {
+        v &= 0x000003ffu;
+        v = (v ^ (v << 16)) & 0xff0000ffu;
+        v = (v ^ (v <<  8)) & 0x0300f00fu;
+        v = (v ^ (v <<  4)) & 0x030c30c3u;
+        v = (v ^ (v <<  2)) & 0x09249249u;
+        return v;
+    }
+
+    inline uint32_t morton(const uint32_t x, const uint32_t y, const uint32_t z)
+    {
+        return part1By2(x) | (part1By2(y) << 1) | (part1By2(z) << 2);
+    }
+
+    inline uint32_t linear(const uint32_t x, const uint32_t y, const uint32_t z, const uint32_t res_x, const uint32_t res_y)
+    {
+        return x + res_x * (y + res_y * z);
+    }
+
+    // Teschner et al. spatial hash; table_size must be a power of two. Different cells can
+    // share a bucket, so the neighbor loops visit each bucket once and filter by distance.
+    inline uint32_t hashed(const int x, const int y, const int z, const uint32_t table_size)
+    {
+        return ((uint32_t(x) * 73856093u) ^ (uint32_t(y) * 19349663u) ^ (uint32_t(z) * 83492791u)) & (table_size - 1);
+    }
+
+    inline uint32_t encode(const CellKeyMode mode, const uint32_t x, const uint32_t y, const uint32_t z,
+                           const uint32_t res_x, const uint32_t res_y)
+    {
+        return mode == CellKeyMode::Morton ? morton(x, y, z) : linear(x, y, z, res_x, res_y);
+    }
+
+    // Size of the cell arrays for a res_x * res_y * res_z grid: one past the largest key.
+    // Both encodings grow with every coordinate, so the largest key is the last cell.
+    inline uint32_t keyCount(const CellKeyMode mode, const uint32_t res_x, const uint32_t res_y, const uint32_t res_z)
+    {
+        return encode(mode, res_x - 1, res_y - 1, res_z - 1, res_x, res_y) + 1;
+    }
+
+    // Morton keys leave gaps when the axes have different power-of-two sizes
+    // (a 600x80x600 grid needs 670M keys instead of 28.8M)
+    constexpr uint64_t kMaxMortonOverhead = 8;
+
+    // Layout a dense grid actually uses: Morton keys only when they fit in 10 bits per axis
+    // and do not blow up the cell arrays by more than kMaxMortonOverhead; Linear otherwise
+    // (also for Hashed, which has no dense grid)
+    inline CellKeyMode effectiveMode(const CellKeyMode mode, const uint32_t res_x, const uint32_t res_y, const uint32_t res_z)
+    {
+        if (mode != CellKeyMode::Morton ||
+            res_x > kMortonAxisCells || res_y > kMortonAxisCells || res_z > kMortonAxisCells)
+        {
+            return CellKeyMode::Linear;
+        }
+
+        const uint64_t num_cells = uint64_t(res_x) * res_y * res_z;
+        const uint64_t num_keys = keyCount(CellKeyMode::Morton, res_x, res_y, res_z);
+        return num_keys <= kMaxMortonOverhead * num_cells ? CellKeyMode::Morton : CellKeyMode::Linear;
+    }
+
+    inline const char* modeName(const CellKeyMode mode)
+    {
+        switch (mode)
+        {
+        case CellKeyMode::Morton: return "morton";
+        case CellKeyMode::Hashed: return "hashed";
+        default:                  return "linear";
+        }
+    }
+}
@@ -1,81 +1,198 @@
 //Kernel.cpp
 #include "Kernel.h"
+#include "Simd.h"
 
-Scalar calcPoly6Kernel(const Vec3& r, const Scalar h)
+template <typename T>
+T calcPoly6Kernel(const Vec3T<T>& r, const T h)
 {
-    constexpr Scalar coeff = 315.0 / (64.0 * M_PI);
+    constexpr T coeff = T(315.0 / (64.0 * M_PI));
 
-    const Scalar h_squared = h * h;
-    const Scalar r_squared = r.squaredNorm();
+    const T h_squared = h * h;
+    const T r_squared = r.squaredNorm();
 
     if (r_squared > h_squared)
     {
-        return 0.0;
+        return T(0);
     }
 
-    const Scalar h_4th_power = h_squared * h_squared;
-    const Scalar h_9th_power = h_4th_power * h_4th_power * h;
-    const Scalar diff = h_squared - r_squared;
-    const Scalar diff_cubed = diff * diff * diff;
+    const T h_4th_power = h_squared * h_squared;
+    const T h_9th_power = h_4th_power * h_4th_power * h;
+    const T diff = h_squared - r_squared;
+    const T diff_cubed = diff * diff * diff;
 
     return (coeff / h_9th_power) * diff_cubed;
 }
 
-Vec3 calcGradPoly6Kernel(const Vec3& r, const Scalar h)
+template <typename T>
+Vec3T<T> calcGradPoly6Kernel(const Vec3T<T>& r, const T h)
 {
-    constexpr Scalar coeff = 945.0 / (32.0 * M_PI);
+    constexpr T coeff = T(945.0 / (32.0 * M_PI));
 
-    const Scalar h_squared = h * h;
-    const Scalar r_squared = r.squaredNorm();
+    const T h_squared = h * h;
+    const T r_squared = r.squaredNorm();
 
     if (r_squared > h_squared)
     {
-        return Vec3::Zero();
+        return Vec3T<T>::Zero();
     }
 
-    const Scalar h_4th_power = h_squared * h_squared;
-    const Scalar h_9th_power = h_4th_power * h_4th_power * h;
+    const T h_4th_power = h_squared * h_squared;
+    const T h_9th_power = h_4th_power * h_4th_power * h;
 
-    const Scalar diff = h_squared - r_squared;
-    const Scalar diff_squared = diff * diff;
+    const T diff = h_squared - r_squared;
+    const T diff_squared = diff * diff;
 
     return -r * (coeff / h_9th_power) * diff_squared;
 }
 
-Scalar calcSpikyKernel(const Vec3& r, const Scalar h)
+template <typename T>
+T calcSpikyKernel(const Vec3T<T>& r, const T h)
 {
-    constexpr Scalar coeff = 15.0 / M_PI;
+    constexpr T coeff = T(15.0 / M_PI);
 
-    const Scalar r_norm = r.norm();
+    const T r_norm = r.norm();
 
     if (r_norm > h)
     {
-        return 0.0;
+        return T(0);
     }
 
-    const Scalar h_cubed = h * h * h;
-    const Scalar h_6th_power = h_cubed * h_cubed;
-    const Scalar diff = h - r_norm;
-    const Scalar diff_cubed = diff * diff * diff;
+    const T h_cubed = h * h * h;
+    const T h_6th_power = h_cubed * h_cubed;
+    const T diff = h - r_norm;
+    const T diff_cubed = diff * diff * diff;
 
     return (coeff / h_6th_power) * diff_cubed;
 }
 
-Vec3 calcGradSpikyKernel(const Vec3& r, const Scalar h)
+template <typename T>
+Vec3T<T> calcGradSpikyKernel(const Vec3T<T>& r, const T h)
 {
-    constexpr Scalar coeff = 45.0 / M_PI;
+    constexpr T coeff = T(45.0 / M_PI);
 
-    const Scalar r_norm = r.norm();
+    const T r_norm = r.norm();
 
     if (r_norm > h)
     {
-        return Vec3::Zero();
+        return Vec3T<T>::Zero();
     }
 
-    const Scalar h_cubed = h * h * h;
-    const Scalar h_6th_power = h_cubed * h_cubed;
-    const Scalar diff = h - r_norm;
-    const Scalar diff_squared = diff * diff;
+    const T h_cubed = h * h * h;
+    const T h_6th_power = h_cubed * h_cubed;
+    const T diff = h - r_norm;
+    const T diff_squared = diff * diff;
 
-    return -r * (coeff / (h_6th_power * std::max(r_norm, 1e-24))) * diff_squared;
-}
\ No newline at end of file
+    return -r * (coeff / (h_6th_power * std::max(r_norm, T(1e-24)))) * diff_squared;
+}
+
+template <typename T>
+KernelCoefficientsT<T>::KernelCoefficientsT(const T h)
+{
+    const T h_cubed = h * h * h;
+    const T h_6th_power = h_cubed * h_cubed;
+    const T h_9th_power = h_6th_power * h_cubed;
+
+    this->h = h;
+    h_squared = h * h;
+    poly6 = T(315.0 / (64.0 * M_PI * h_9th_power));
+    grad_poly6 = T(-945.0 / (32.0 * M_PI * h_9th_power));
+    spiky = T(15.0 / (M_PI * h_6th_power));
+    grad_spiky = T(-45.0 / (M_PI * h_6th_power));
+}
+
+template <typename T>
+void calcPoly6KernelBatch(const KernelCoefficientsT<T>& c, const T* r_x, const T* r_y, const T* r_z, const int n, T* w)
+{
+    simd::forEachPack<T>(n, [&](auto tag, const int k)
+    {
+        using P = typename decltype(tag)::type;
+
+        const P x = P::load(r_x + k);
+        const P y = P::load(r_y + k);
+        const P z = P::load(r_z + k);
+
+        // diff clamps to zero outside the support: no branch, no mask
+        const P r_squared = x * x + y * y + z * z;
+        const P diff = simd::max(P::broadcast(c.h_squared) - r_squared, P::broadcast(0.0));
+
+        (P::broadcast(c.poly6) * diff * diff * diff).store(w + k);
+    });
+}
+
+template <typename T>
+void calcGradPoly6KernelBatch(const KernelCoefficientsT<T>& c, const T* r_x, const T* r_y, const T* r_z, const int n, T* g_x, T* g_y, T* g_z)
+{
+    simd::forEachPack<T>(n, [&](auto tag, const int k)
+    {
+        using P = typename decltype(tag)::type;
+
+        const P x = P::load(r_x + k);
+        const P y = P::load(r_y + k);
+        const P z = P::load(r_z + k);
+
+        const P r_squared = x * x + y * y + z * z;
+        const P diff = simd::max(P::broadcast(c.h_squared) - r_squared, P::broadcast(0.0));
+        const P scale = P::broadcast(c.grad_poly6) * diff * diff;
+
+        (scale * x).store(g_x + k);
+        (scale * y).store(g_y + k);
+        (scale * z).store(g_z + k);
+    });
+}
+
+template <typename T>
+void calcSpikyKernelBatch(const KernelCoefficientsT<T>& c, const T* r_x, const T* r_y, const T* r_z, const int n, T* w)
+{
+    simd::forEachPack<T>(n, [&](auto tag, const int k)
+    {
+        using P = typename decltype(tag)::type;
+
+        const P x = P::load(r_x + k);
+        const P y = P::load(r_y + k);
+        const P z = P::load(r_z + k);
+
+        const P r_norm = simd::sqrt(x * x + y * y + z * z);
+        const P diff = simd::max(P::broadcast(c.h) - r_norm, P::broadcast(0.0));
+
+        (P::broadcast(c.spiky) * diff * diff * diff).store(w + k);
+    });
+}
+
+template <typename T>
+void calcGradSpikyKernelBatch(const KernelCoefficientsT<T>& c, const T* r_x, const T* r_y, const T* r_z, const int n, T* g_x, T* g_y, T* g_z)
+{
+    simd::forEachPack<T>(n, [&](auto tag, const int k)
+    {
+        using P = typename decltype(tag)::type;
+
+        const P x = P::load(r_x + k);
+        const P y = P::load(r_y + k);
+        const P z = P::load(r_z + k);
+
+        // r = 0 (the particle itself) gives diff * 0 / 1e-24 = 0
+        const P r_norm = simd::sqrt(x * x + y * y + z * z);
+        const P diff = simd::max(P::broadcast(c.h) - r_norm, P::broadcast(0.0));
+        const P scale = P::broadcast(c.grad_spiky) * diff * diff / simd::max(r_norm, P::broadcast(1e-24));
+
+        (scale * x).store(g_x + k);
+        (scale * y).store(g_y + k);
+        (scale * z).store(g_z + k);
+    });
+}
+
+// Explicit instantiations: the solver is built for both precisions
+#define INSTANTIATE_KERNELS(T) \
+    template T calcPoly6Kernel<T>(const Vec3T<T>&, const T); \
+    template Vec3T<T> calcGradPoly6Kernel<T>(const Vec3T<T>&, const T); \
+    template T calcSpikyKernel<T>(const Vec3T<T>&, const T); \
+    template Vec3T<T> calcGradSpikyKernel<T>(const Vec3T<T>&, const T); \
+    template struct KernelCoefficientsT<T>; \
+    template void calcPoly6KernelBatch<T>(const KernelCoefficientsT<T>&, const T*, const T*, const T*, const int, T*); \
+    template void calcGradPoly6KernelBatch<T>(const KernelCoefficientsT<T>&, const T*, const T*, const T*, const int, T*, T*, T*); \
+    template void calcSpikyKernelBatch<T>(const KernelCoefficientsT<T>&, const T*, const T*, const T*, const int, T*); \
+    template void calcGradSpikyKernelBatch<T>(const KernelCoefficientsT<T>&, const T*, const T*, const T*, const int, T*, T*, T*);
+
+INSTANTIATE_KERNELS(float)
+INSTANTIATE_KERNELS(double)
+
+#undef INSTANTIATE_KERNELS
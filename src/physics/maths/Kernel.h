@@ -3,11 +3,50 @@
 
 #include "../../support/Common.h"
 
-Scalar calcPoly6Kernel(const Vec3& r, const Scalar h);
-Vec3 calcGradPoly6Kernel(const Vec3& r, const Scalar h);
+// Every kernel is a template on the scalar type, instantiated for float and double in Kernel.cpp
+template <typename T> T calcPoly6Kernel(const Vec3T<T>& r, const T h);
+template <typename T> Vec3T<T> calcGradPoly6Kernel(const Vec3T<T>& r, const T h);
 
-Scalar calcSpikyKernel(const Vec3& r, const Scalar h);
-Vec3 calcGradSpikyKernel(const Vec3& r, const Scalar h);
+template <typename T> T calcSpikyKernel(const Vec3T<T>& r, const T h);
+template <typename T> Vec3T<T> calcGradSpikyKernel(const Vec3T<T>& r, const T h);
 
-constexpr auto CalcKernel = calcPoly6Kernel;
-constexpr auto CalcGradKernel = calcGradSpikyKernel;
\ No newline at end of file
+template <typename T> inline T CalcKernel(const Vec3T<T>& r, const T h) { return calcPoly6Kernel<T>(r, h); }
+template <typename T> inline Vec3T<T> CalcGradKernel(const Vec3T<T>& r, const T h) { return calcGradSpikyKernel<T>(r, h); }
+
+// Kernel constants for a fixed support radius h, computed once instead of on every call
+template <typename T>
+struct KernelCoefficientsT
+{
+    T h;
+    T h_squared;
+    T poly6;       //  315 / (64 pi h^9)
+    T grad_poly6;  // -945 / (32 pi h^9)
+    T spiky;       //   15 / (pi h^6)
+    T grad_spiky;  //  -45 / (pi h^6)
+
+    explicit KernelCoefficientsT(const T h);
+};
+
+using KernelCoefficients = KernelCoefficientsT<Scalar>;
+
+// Batched kernels: one particle against a block of n neighbors.
+// r_x/r_y/r_z hold the relative positions (target - neighbor) of the block.
+// Evaluated with AVX-512/AVX2 when available (scalar otherwise) and without
+// branches: pairs outside the support radius simply produce zero.
+template <typename T> void calcPoly6KernelBatch(const KernelCoefficientsT<T>& c, const T* r_x, const T* r_y, const T* r_z, const int n, T* w);
+template <typename T> void calcGradPoly6KernelBatch(const KernelCoefficientsT<T>& c, const T* r_x, const T* r_y, const T* r_z, const int n, T* g_x, T* g_y, T* g_z);
+
+template <typename T> void calcSpikyKernelBatch(const KernelCoefficientsT<T>& c, const T* r_x, const T* r_y, const T* r_z, const int n, T* w);
+template <typename T> void calcGradSpikyKernelBatch(const KernelCoefficientsT<T>& c, const T* r_x, const T* r_y, const T* r_z, const int n, T* g_x, T* g_y, T* g_z);
+
+template <typename T>
+inline void CalcKernelBatch(const KernelCoefficientsT<T>& c, const T* r_x, const T* r_y, const T* r_z, const int n, T* w)
+{
+    calcPoly6KernelBatch<T>(c, r_x, r_y, r_z, n, w);
+}
+
+template <typename T>
+inline void CalcGradKernelBatch(const KernelCoefficientsT<T>& c, const T* r_x, const T* r_y, const T* r_z, const int n, T* g_x, T* g_y, T* g_z)
+{
+    calcGradSpikyKernelBatch<T>(c, r_x, r_y, r_z, n, g_x, g_y, g_z);
+}
@@ -0,0 +1,186 @@
+// Simd.h
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Thin wrappers over the vector registers used by the batched kernels.
+// Every pack type exposes the same interface (width, load, broadcast, store, the
+// arithmetic operators, reduceAdd and anyLess), so a kernel is written once as a template and is
+// instantiated for the widest pack the compiler targets plus a scalar tail.
+namespace simd
+{
+    // ---- Scalar fallback (also used for loop tails) ----------------------------
+    template <typename T>
+    struct ScalarPack
+    {
+        static constexpr int width = 1;
+        T v;
+
+        static inline ScalarPack load(const T* ptr) { return { *ptr }; }
+        static inline ScalarPack broadcast(const T value) { return { value }; }
+        inline void store(T* ptr) const { *ptr = v; }
+    };
+
+    template <typename T> inline ScalarPack<T> operator+(ScalarPack<T> a, ScalarPack<T> b) { return { a.v + b.v }; }
+    template <typename T> inline ScalarPack<T> operator-(ScalarPack<T> a, ScalarPack<T> b) { return { a.v - b.v }; }
+    template <typename T> inline ScalarPack<T> operator*(ScalarPack<T> a, ScalarPack<T> b) { return { a.v * b.v }; }
+    template <typename T> inline ScalarPack<T> operator/(ScalarPack<T> a, ScalarPack<T> b) { return { a.v / b.v }; }
+    template <typename T> inline ScalarPack<T> max(ScalarPack<T> a, ScalarPack<T> b) { return { std::max(a.v, b.v) }; }
+    template <typename T> inline ScalarPack<T> sqrt(ScalarPack<T> a) { return { std::sqrt(a.v) }; }
+    template <typename T> inline T reduceAdd(ScalarPack<T> a) { return a.v; }
+    template <typename T> inline bool anyLess(ScalarPack<T> a, const T value) { return a.v < value; }
+
+#if defined(__AVX2__)
+    // ---- AVX2: 8 floats ---------------------------------------------------------
+    struct PackF8
+    {
+        static constexpr int width = 8;
+        __m256 v;
+
+        static inline PackF8 load(const float* ptr) { return { _mm256_loadu_ps(ptr) }; }
+        static inline PackF8 broadcast(const float value) { return { _mm256_set1_ps(value) }; }
+        inline void store(float* ptr) const { _mm256_storeu_ps(ptr, v); }
+    };
+
+    inline PackF8 operator+(PackF8 a, PackF8 b) { return { _mm256_add_ps(a.v, b.v) }; }
+    inline PackF8 operator-(PackF8 a, PackF8 b) { return { _mm256_sub_ps(a.v, b.v) }; }
+    inline PackF8 operator*(PackF8 a, PackF8 b) { return { _mm256_mul_ps(a.v, b.v) }; }
+    inline PackF8 operator/(PackF8 a, PackF8 b) { return { _mm256_div_ps(a.v, b.v) }; }
+    inline PackF8 max(PackF8 a, PackF8 b) { return { _mm256_max_ps(a.v, b.v) }; }
+    inline PackF8 sqrt(PackF8 a) { return { _mm256_sqrt_ps(a.v) }; }
+
+    inline float reduceAdd(PackF8 a)
+    {
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+        return _mm_cvtss_f32(sum);
+    }
+
+    inline bool anyLess(PackF8 a, const float value)
+    {
+        return _mm256_movemask_ps(_mm256_cmp_ps(a.v, _mm256_set1_ps(value), _CMP_LT_OQ)) != 0;
+    }
+
+    // ---- AVX2: 4 doubles --------------------------------------------------------
+    struct PackD4
+    {
+        static constexpr int width = 4;
+        __m256d v;
+
+        static inline PackD4 load(const double* ptr) { return { _mm256_loadu_pd(ptr) }; }
+        static inline PackD4 broadcast(const double value) { return { _mm256_set1_pd(value) }; }
+        inline void store(double* ptr) const { _mm256_storeu_pd(ptr, v); }
+    };
+
+    inline PackD4 operator+(PackD4 a, PackD4 b) { return { _mm256_add_pd(a.v, b.v) }; }
+    inline PackD4 operator-(PackD4 a, PackD4 b) { return { _mm256_sub_pd(a.v, b.v) }; }
+    inline PackD4 operator*(PackD4 a, PackD4 b) { return { _mm256_mul_pd(a.v, b.v) }; }
+    inline PackD4 operator/(PackD4 a, PackD4 b) { return { _mm256_div_pd(a.v, b.v) }; }
+    inline PackD4 max(PackD4 a, PackD4 b) { return { _mm256_max_pd(a.v, b.v) }; }
+    inline PackD4 sqrt(PackD4 a) { return { _mm256_sqrt_pd(a.v) }; }
+
+    inline double reduceAdd(PackD4 a)
+    {
+        __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(a.v), _mm256_extractf128_pd(a.v, 1));
+        sum = _mm_add_sd(sum, _mm_unpackhi_pd(sum, sum));
+        return _mm_cvtsd_f64(sum);
+    }
+
+    inline bool anyLess(PackD4 a, const double value)
+    {
+        return _mm256_movemask_pd(_mm256_cmp_pd(a.v, _mm256_set1_pd(value), _CMP_LT_OQ)) != 0;
+    }
+#endif
+
+#if defined(__AVX512F__)
+    // ---- AVX-512: 16 floats -----------------------------------------------------
+    struct PackF16
+    {
+        static constexpr int width = 16;
+        __m512 v;
+
+        static inline PackF16 load(const float* ptr) { return { _mm512_loadu_ps(ptr) }; }
+        static inline PackF16 broadcast(const float value) { return { _mm512_set1_ps(value) }; }
+        inline void store(float* ptr) const { _mm512_storeu_ps(ptr, v); }
+    };
+
+    inline PackF16 operator+(PackF16 a, PackF16 b) { return { _mm512_add_ps(a.v, b.v) }; }
+    inline PackF16 operator-(PackF16 a, PackF16 b) { return { _mm512_sub_ps(a.v, b.v) }; }
+    inline PackF16 operator*(PackF16 a, PackF16 b) { return { _mm512_mul_ps(a.v, b.v) }; }
+    inline PackF16 operator/(PackF16 a, PackF16 b) { return { _mm512_div_ps(a.v, b.v) }; }
+    inline PackF16 max(PackF16 a, PackF16 b) { return { _mm512_max_ps(a.v, b.v) }; }
+    inline PackF16 sqrt(PackF16 a) { return { _mm512_sqrt_ps(a.v) }; }
+    inline float reduceAdd(PackF16 a) { return _mm512_reduce_add_ps(a.v); }
+    inline bool anyLess(PackF16 a, const float value) { return _mm512_cmp_ps_mask(a.v, _mm512_set1_ps(value), _CMP_LT_OQ) != 0; }
+
+    // ---- AVX-512: 8 doubles -----------------------------------------------------
+    struct PackD8
+    {
+        static constexpr int width = 8;
+        __m512d v;
+
+        static inline PackD8 load(const double* ptr) { return { _mm512_loadu_pd(ptr) }; }
+        static inline PackD8 broadcast(const double value) { return { _mm512_set1_pd(value) }; }
+        inline void store(double* ptr) const { _mm512_storeu_pd(ptr, v); }
+    };
+
+    inline PackD8 operator+(PackD8 a, PackD8 b) { return { _mm512_add_pd(a.v, b.v) }; }
+    inline PackD8 operator-(PackD8 a, PackD8 b) { return { _mm512_sub_pd(a.v, b.v) }; }
+    inline PackD8 operator*(PackD8 a, PackD8 b) { return { _mm512_mul_pd(a.v, b.v) }; }
+    inline PackD8 operator/(PackD8 a, PackD8 b) { return { _mm512_div_pd(a.v, b.v) }; }
+    inline PackD8 max(PackD8 a, PackD8 b) { return { _mm512_max_pd(a.v, b.v) }; }
+    inline PackD8 sqrt(PackD8 a) { return { _mm512_sqrt_pd(a.v) }; }
+    inline double reduceAdd(PackD8 a) { return _mm512_reduce_add_pd(a.v); }
+    inline bool anyLess(PackD8 a, const double value) { return _mm512_cmp_pd_mask(a.v, _mm512_set1_pd(value), _CMP_LT_OQ) != 0; }
+#endif
+
+    // ---- Widest pack for each element type ----------------------------------------
+    template <typename T>
+    struct NativePack { using type = ScalarPack<T>; };
+
+#if defined(__AVX512F__)
+    template <> struct NativePack<float> { using type = PackF16; };
+    template <> struct NativePack<double> { using type = PackD8; };
+#elif defined(__AVX2__)
+    template <> struct NativePack<float> { using type = PackF8; };
+    template <> struct NativePack<double> { using type = PackD4; };
+#endif
+
+    template <typename P>
+    struct PackTag { using type = P; };
+
+    // Calls f(PackTag<P>{}, k) over [0, n): full native packs first, then the scalar tail
+    template <typename T, typename F>
+    inline void forEachPack(const int n, F&& f)
+    {
+        using Wide = typename NativePack<T>::type;
+
+        int k = 0;
+        for (; k + Wide::width <= n; k += Wide::width)
+        {
+            f(PackTag<Wide>{}, k);
+        }
+        for (; k < n; ++k)
+        {
+            f(PackTag<ScalarPack<T>>{}, k);
+        }
+    }
+
+    // Name of the instruction set the native packs were compiled for
+    inline const char* isaName()
+    {
+#if defined(__AVX512F__)
+        return "AVX-512";
+#elif defined(__AVX2__)
+        return "AVX2";
+#else
+        return "scalar";
+#endif
+    }
+}
@@ -0,0 +1,178 @@
+#include "SphPairKernels.h"
+
+namespace
+{
+    using Wide = simd::NativePack<float>::type;
+
+    // Running sum over the packs of a block: full packs add lane by lane, the scalar
+    // tail separately, and the lanes are reduced once at the end
+    struct PackSum
+    {
+        Wide wide = Wide::broadcast(0.0f);
+        float tail = 0.0f;
+
+        template <typename P>
+        inline void add(const P value)
+        {
+            if constexpr (P::width == Wide::width)
+                wide = wide + value;
+            else
+                tail += value.v;
+        }
+
+        inline float total() const { return simd::reduceAdd(wide) + tail; }
+    };
+}
+
+float sumDensityBatch(const SphPairCoefficients& c, const float* pos, const SphNeighborArrays& nb, const int n)
+{
+    PackSum sum;
+
+    simd::forEachPack<float>(n, [&](auto tag, const int k)
+    {
+        using P = typename decltype(tag)::type;
+
+        const P x = P::load(nb.p_x + k) - P::broadcast(pos[0]);
+        const P y = P::load(nb.p_y + k) - P::broadcast(pos[1]);
+        const P z = P::load(nb.p_z + k) - P::broadcast(pos[2]);
+
+        const P r_squared = x * x + y * y + z * z;
+        const P diff = simd::max(P::broadcast(c.h_squared) - r_squared, P::broadcast(0.0f));
+
+        sum.add(diff * diff * diff);
+    });
+
+    return sum.total();
+}
+
+SphForceSums sumForceBatch(const SphPairCoefficients& c, const float* pos, const float* ev, const float pres,
+                           const SphNeighborArrays& nb, const int n)
+{
+    PackSum acc_x, acc_y, acc_z;
+    PackSum grad_x, grad_y, grad_z;
+    PackSum lplc;
+
+    simd::forEachPack<float>(n, [&](auto tag, const int k)
+    {
+        using P = typename decltype(tag)::type;
+
+        // Relative position: target - neighbor
+        const P x = P::broadcast(pos[0]) - P::load(nb.p_x + k);
+        const P y = P::broadcast(pos[1]) - P::load(nb.p_y + k);
+        const P z = P::broadcast(pos[2]) - P::load(nb.p_z + k);
+
+        const P r_squared = x * x + y * y + z * z;
+
+        // Most of a 3x3x3 block lies outside the support: a pack without any pair is skipped
+        // (one compare instead of the sqrt and division)
+        if (!simd::anyLess(r_squared, c.h_squared))
+            return;
+
+        const P r_norm = simd::sqrt(r_squared);
+        const P spiky_diff = simd::max(P::broadcast(c.h) - r_norm, P::broadcast(0.0f));
+        const P poly6_diff = simd::max(P::broadcast(c.h_squared) - r_squared, P::broadcast(0.0f));
+
+        const P vol = P::load(nb.vol + k);
+
+        // Pressure: r = 0 (the particle itself) gives 0 * diff^2 / 1e-24 = 0
+        const P pressure = vol * (P::broadcast(pres) + P::load(nb.pres + k)) * P::broadcast(c.spiky) * spiky_diff * spiky_diff
+                         / simd::max(r_norm, P::broadcast(1e-24f));
+
+        // Viscosity: the particle itself has no relative velocity
+        const P viscous = vol * P::broadcast(c.viscosity * c.visco) * spiky_diff;
+        const P v_x = P::load(nb.ev_x + k) - P::broadcast(ev[0]);
+        const P v_y = P::load(nb.ev_y + k) - P::broadcast(ev[1]);
+        const P v_z = P::load(nb.ev_z + k) - P::broadcast(ev[2]);
+
+        acc_x.add(v_x * viscous - x * pressure);
+        acc_y.add(v_y * viscous - y * pressure);
+        acc_z.add(v_z * viscous - z * pressure);
+
+        // Color field (surface tension). The laplacian factor (r^2 - 3 / 4 (h^2 - r^2)) of the
+        // scalar solver used an integer 3 / 4, i.e. it is just r^2
+        const P color = P::broadcast(-c.grad_poly6) * vol * poly6_diff * poly6_diff;
+        grad_x.add(color * x);
+        grad_y.add(color * y);
+        grad_z.add(color * z);
+        lplc.add(P::broadcast(c.lplc_poly6) * vol * poly6_diff * r_squared);
+    });
+
+    SphForceSums sums;
+    sums.acc_x = acc_x.total();
+    sums.acc_y = acc_y.total();
+    sums.acc_z = acc_z.total();
+    sums.grad_x = grad_x.total();
+    sums.grad_y = grad_y.total();
+    sums.grad_z = grad_z.total();
+    sums.lplc = lplc.total();
+    return sums;
+}
+
+SphForceSums sumForcePairsBatch(const SphPairCoefficients& c, const float* pos, const float* ev, const float pres,
+                                const float vol, const SphNeighborArrays& nb, const int n, const SphForceArrays& out)
+{
+    PackSum acc_x, acc_y, acc_z;
+    PackSum grad_x, grad_y, grad_z;
+    PackSum lplc;
+
+    simd::forEachPack<float>(n, [&](auto tag, const int k)
+    {
+        using P = typename decltype(tag)::type;
+
+        const P x = P::broadcast(pos[0]) - P::load(nb.p_x + k);
+        const P y = P::broadcast(pos[1]) - P::load(nb.p_y + k);
+        const P z = P::broadcast(pos[2]) - P::load(nb.p_z + k);
+
+        const P r_squared = x * x + y * y + z * z;
+
+        // Packs without any pair are skipped, and with them the read-modify-write of the reactions
+        if (!simd::anyLess(r_squared, c.h_squared))
+            return;
+
+        const P r_norm = simd::sqrt(r_squared);
+        const P spiky_diff = simd::max(P::broadcast(c.h) - r_norm, P::broadcast(0.0f));
+        const P poly6_diff = simd::max(P::broadcast(c.h_squared) - r_squared, P::broadcast(0.0f));
+
+        // Pair terms without the volumes: the same for both sides up to the sign
+        const P pressure = (P::broadcast(pres) + P::load(nb.pres + k)) * P::broadcast(c.spiky) * spiky_diff * spiky_diff
+                         / simd::max(r_norm, P::broadcast(1e-24f));
+        const P viscous = P::broadcast(c.viscosity * c.visco) * spiky_diff;
+        const P v_x = P::load(nb.ev_x + k) - P::broadcast(ev[0]);
+        const P v_y = P::load(nb.ev_y + k) - P::broadcast(ev[1]);
+        const P v_z = P::load(nb.ev_z + k) - P::broadcast(ev[2]);
+
+        const P f_x = v_x * viscous - x * pressure;
+        const P f_y = v_y * viscous - y * pressure;
+        const P f_z = v_z * viscous - z * pressure;
+        const P color = P::broadcast(-c.grad_poly6) * poly6_diff * poly6_diff;
+        const P laplacian = P::broadcast(c.lplc_poly6) * poly6_diff * r_squared;
+
+        const P vol_j = P::load(nb.vol + k);
+        acc_x.add(vol_j * f_x);
+        acc_y.add(vol_j * f_y);
+        acc_z.add(vol_j * f_z);
+        grad_x.add(vol_j * color * x);
+        grad_y.add(vol_j * color * y);
+        grad_z.add(vol_j * color * z);
+        lplc.add(vol_j * laplacian);
+
+        const P vol_i = P::broadcast(vol);
+        (P::load(out.acc_x + k) - vol_i * f_x).store(out.acc_x + k);
+        (P::load(out.acc_y + k) - vol_i * f_y).store(out.acc_y + k);
+        (P::load(out.acc_z + k) - vol_i * f_z).store(out.acc_z + k);
+        (P::load(out.grad_x + k) - vol_i * color * x).store(out.grad_x + k);
+        (P::load(out.grad_y + k) - vol_i * color * y).store(out.grad_y + k);
+        (P::load(out.grad_z + k) - vol_i * color * z).store(out.grad_z + k);
+        (P::load(out.lplc + k) + vol_i * laplacian).store(out.lplc + k);
+    });
+
+    SphForceSums sums;
+    sums.acc_x = acc_x.total();
+    sums.acc_y = acc_y.total();
+    sums.acc_z = acc_z.total();
+    sums.grad_x = grad_x.total();
+    sums.grad_y = grad_y.total();
+    sums.grad_z = grad_z.total();
+    sums.lplc = lplc.total();
+    return sums;
+}
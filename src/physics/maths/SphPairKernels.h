@@ -0,0 +1,73 @@
+// SphPairKernels.h
+#pragma once
+
+// Pair sums of SPH_System (Muller et al. 2003 kernels, float): one particle against a
+// block of n neighbors stored SoA. Evaluated with AVX-512/AVX2 when available (scalar
+// otherwise) without libm calls: pairs outside the support radius, and the particle
+// itself, contribute zero, and the force kernels skip the packs that hold no pair.
+
+#include "Simd.h"
+
+// Lanes of the packed kernels: a block whose length is a multiple of it has no scalar tail
+constexpr int kSphPackWidth = simd::NativePack<float>::type::width;
+
+// Kernel constants of SPH_System, computed once
+struct SphPairCoefficients
+{
+    float h = 0.0f;
+    float h_squared = 0.0f;
+    float spiky = 0.0f;        //  -45 / (pi h^6), pressure gradient
+    float visco = 0.0f;        //   45 / (pi h^6), viscosity laplacian
+    float grad_poly6 = 0.0f;   // -945 / (32 pi h^9)
+    float lplc_poly6 = 0.0f;   // -945 / (8 pi h^9)
+    float viscosity = 0.0f;
+};
+
+// Neighbor block, one entry per candidate neighbor
+struct SphNeighborArrays
+{
+    const float* p_x;
+    const float* p_y;
+    const float* p_z;
+    const float* ev_x;
+    const float* ev_y;
+    const float* ev_z;
+    const float* vol;          // mass / density / 2
+    const float* pres;
+};
+
+// Per-neighbor output of the symmetric force kernel, indexed as SphNeighborArrays
+struct SphForceArrays
+{
+    float* acc_x;
+    float* acc_y;
+    float* acc_z;
+    float* grad_x;
+    float* grad_y;
+    float* grad_z;
+    float* lplc;
+};
+
+struct SphForceSums
+{
+    float acc_x = 0.0f;
+    float acc_y = 0.0f;
+    float acc_z = 0.0f;
+    float grad_x = 0.0f;       // color field gradient
+    float grad_y = 0.0f;
+    float grad_z = 0.0f;
+    float lplc = 0.0f;         // color field laplacian
+};
+
+// Sum of (h^2 - r^2)^3 over the block (only the positions are read); the particle itself adds h^6
+float sumDensityBatch(const SphPairCoefficients& c, const float* pos, const SphNeighborArrays& nb, const int n);
+
+// Pressure and viscosity acceleration and color field terms of the block
+SphForceSums sumForceBatch(const SphPairCoefficients& c, const float* pos, const float* ev, const float pres,
+                           const SphNeighborArrays& nb, const int n);
+
+// Same terms, each pair evaluated once (half neighbor list): returns the sums of the particle
+// and adds its reaction to each neighbor in 'out', weighted by the particle's own volume. The
+// pressure, viscosity and color gradient terms change sign, the color laplacian does not.
+SphForceSums sumForcePairsBatch(const SphPairCoefficients& c, const float* pos, const float* ev, const float pres,
+                                const float vol, const SphNeighborArrays& nb, const int n, const SphForceArrays& out);
@@ -3,101 +3,300 @@
 
 // ?
 #include <cassert>
+#include <algorithm>
+#include <omp.h>
 
-HashGrid::HashGrid(const Scalar radius, const std::vector<PBF_Particle>& particles)
-    : NeighborSearchEngine(radius, particles)
+namespace
+{
+    // Contiguous [begin, end) block of 'count' items owned by 'thread'
+    inline std::pair<int, int> threadRange(const int count, const int thread, const int num_threads)
+    {
+        const int chunk = (count + num_threads - 1) / num_threads;
+        const int begin = std::min(count, thread * chunk);
+        const int end = std::min(count, begin + chunk);
+        return { begin, end };
+    }
+}
+
+template <typename T>
+HashGridT<T>::HashGridT(const Scalar radius, const ParticleData& particles)
+    : Base(radius, particles)
 {
 }
 
-void HashGrid::searchNeighbors()
+template <typename T>
+void HashGridT<T>::searchNeighbors()
 {
     const int    num_particles = m_particles.size();
-    const Scalar radius_squared = m_radius * m_radius;
+    const Scalar search_radius = this->getSearchRadius();
+    const Scalar radius_squared = search_radius * search_radius;
 
-    MatX positions(3, num_particles);
-    for (int i = 0; i < num_particles; ++i)
-    {
-        positions.col(i) = m_particles[i].p;
-    }
+    constructGridCells();
 
-    auto grid_cells = constructGridCells(m_radius, positions);
+    const Scalar* p_x = m_particles.p.col(0).data();
+    const Scalar* p_y = m_particles.p.col(1).data();
+    const Scalar* p_z = m_particles.p.col(2).data();
 
-    m_neighbors_list = std::vector<std::vector<int>>(num_particles);
+    m_thread_neighbors.resize(omp_get_max_threads());
+    m_neighbor_offsets.resize(num_particles + 1);
 
-    for (int i = 0; i < num_particles; ++i)
+    // Each thread owns a contiguous block of particles and appends their neighbors
+    // to its own buffer; the buffers are then concatenated into one CSR array.
+    // Neighbor order only depends on the cell layout, never on the thread count.
+    #pragma omp parallel
     {
-        // Determine the cell that the target particle belongs to
-        const auto target_cell_index = calcGridIndex(m_radius, positions, i);
+        const int thread = omp_get_thread_num();
+        const auto [begin, end] = threadRange(num_particles, thread, omp_get_num_threads());
+
+        auto& buffer = m_thread_neighbors[thread];
+        const std::size_t capacity = buffer.capacity();
+        buffer.clear();
 
-        // Visit the 26 neighbor cells and the cell itself (27 in total)
-        for (int x : {-1, 0, 1})
+        for (int i = begin; i < end; ++i)
         {
-            for (int y : {-1, 0, 1})
-            {
-                for (int z : {-1, 0, 1})
-                {
-                    const int i_x = std::get<0>(target_cell_index) + x;
-                    const int i_y = std::get<1>(target_cell_index) + y;
-                    const int i_z = std::get<2>(target_cell_index) + z;
+            const std::size_t first = buffer.size();
 
-                    const int cell_index = convertGridIndexToArrayIndex({ i_x, i_y, i_z });
+            // Cell that the target particle belongs to
+            const auto [c_x, c_y, c_z] = calcGridIndex(Vec3(p_x[i], p_y[i], p_z[i]));
 
-                    const auto& list = grid_cells[cell_index];
+            // Visit the 26 neighbor cells and the cell itself (27 in total).
+            // The grid is padded by one cell, so the stencil never leaves it.
+            // Hashed: two cells of the stencil can share a bucket, which is visited once.
+            int visited[27];
+            int num_visited = 0;
 
-                    // Register particles as neighbors if they are within the range
-                    for (const int index : list)
+            for (int x : {-1, 0, 1})
+            {
+                for (int y : {-1, 0, 1})
+                {
+                    for (int z : {-1, 0, 1})
                     {
-                        const Scalar squared_dist = (m_particles[i].p - m_particles[index].p).squaredNorm();
+                        const int cell = convertGridIndexToArrayIndex(GridIndex{ c_x + x, c_y + y, c_z + z });
+                        if (m_active_key_mode == CellKeyMode::Hashed)
+                        {
+                            if (std::find(visited, visited + num_visited, cell) != visited + num_visited)
+                            {
+                                continue;
+                            }
+                            visited[num_visited++] = cell;
+                        }
 
-                        if (squared_dist < radius_squared)
+                        // Register particles as neighbors if they are within the range
+                        for (int k = m_cell_start[cell]; k < m_cell_end[cell]; ++k)
                         {
-                            m_neighbors_list[i].push_back(index);
+                            const int index = m_sorted_indices[k];
+                            const Scalar d_x = p_x[i] - p_x[index];
+                            const Scalar d_y = p_y[i] - p_y[index];
+                            const Scalar d_z = p_z[i] - p_z[index];
+                            const Scalar squared_dist = d_x * d_x + d_y * d_y + d_z * d_z;
+
+                            if (squared_dist < radius_squared)
+                            {
+                                buffer.push_back(index);
+                            }
                         }
                     }
                 }
             }
+
+            m_neighbor_offsets[i + 1] = static_cast<int>(buffer.size() - first);
+        }
+
+        #pragma omp barrier
+
+        // Neighbor counts -> CSR offsets
+        #pragma omp single
+        {
+            m_neighbor_offsets[0] = 0;
+            for (int i = 0; i < num_particles; ++i)
+            {
+                m_neighbor_offsets[i + 1] += m_neighbor_offsets[i];
+            }
+            const std::size_t num_neighbors = m_neighbor_offsets[num_particles];
+            if (m_neighbor_indices.capacity() < num_neighbors)
+            {
+                m_neighbor_indices.reserve(2 * num_neighbors);
+            }
+            m_neighbor_indices.resize(num_neighbors);
+        }
+
+        // Merge: every thread copies its buffer to its own slice of the CSR array
+        if (begin < end)
+        {
+            std::copy(buffer.begin(), buffer.end(), m_neighbor_indices.begin() + m_neighbor_offsets[begin]);
+        }
+
+        // Pair counts have no upper bound to reserve for: a buffer that had to grow (or that
+        // an even share of the lists would overflow, for blocks that start sparse) gets twice
+        // that, so a later build only allocates once the lists have doubled
+        const std::size_t share = std::max(buffer.size(), m_neighbor_indices.size() / omp_get_num_threads());
+        if (buffer.capacity() != capacity || buffer.capacity() < share)
+        {
+            buffer.reserve(2 * share);
         }
     }
 }
 
-HashGrid::GridIndex HashGrid::calcGridIndex(const Scalar radius, const MatX& positions, const int target_particle_index)
+template <typename T>
+typename HashGridT<T>::GridIndex HashGridT<T>::calcGridIndex(const Vec3& position) const
 {
-    const auto pos = positions.col(target_particle_index);
-    const Vec3 grid_coord_pos = (pos - k_grid_center) * (1.0 / radius) + 0.5 * Vec3(k_n_x, k_n_y, k_n_z);
+    const Vec3 grid_coord_pos = position * (Scalar(1) / this->getSearchRadius());
 
-    const int i_x = std::floor(grid_coord_pos[0]);
-    const int i_y = std::floor(grid_coord_pos[1]);
-    const int i_z = std::floor(grid_coord_pos[2]);
+    const int i_x = static_cast<int>(std::floor(grid_coord_pos[0])) - m_grid_min[0];
+    const int i_y = static_cast<int>(std::floor(grid_coord_pos[1])) - m_grid_min[1];
+    const int i_z = static_cast<int>(std::floor(grid_coord_pos[2])) - m_grid_min[2];
 
-    assert(i_x >= 0);
-    assert(i_y >= 0);
-    assert(i_z >= 0);
-    assert(i_x < k_n_x);
-    assert(i_y < k_n_y);
-    assert(i_z < k_n_z);
+    assert(i_x >= 1);
+    assert(i_y >= 1);
+    assert(i_z >= 1);
+    assert(i_x < m_grid_res[0] - 1);
+    assert(i_y < m_grid_res[1] - 1);
+    assert(i_z < m_grid_res[2] - 1);
 
     return GridIndex{ i_x, i_y, i_z };
 }
 
-int HashGrid::convertGridIndexToArrayIndex(const GridIndex& index)
+template <typename T>
+int HashGridT<T>::convertGridIndexToArrayIndex(const GridIndex& index) const
 {
-    return std::get<0>(index) + k_n_x * std::get<1>(index) + k_n_x * k_n_y * std::get<2>(index);
+    if (m_active_key_mode == CellKeyMode::Hashed)
+    {
+        return static_cast<int>(cellkey::hashed(std::get<0>(index), std::get<1>(index), std::get<2>(index), m_hash_table_size));
+    }
+    return static_cast<int>(cellkey::encode(m_active_key_mode,
+                                            std::get<0>(index), std::get<1>(index), std::get<2>(index),
+                                            m_grid_res[0], m_grid_res[1]));
 }
 
-std::unordered_map<int, std::vector<int>> HashGrid::constructGridCells(const Scalar radius, const MatX& positions)
+template <typename T>
+void HashGridT<T>::constructGridCells()
 {
-    std::unordered_map<int, std::vector<int>> grid_cells;
+    const int num_particles = m_particles.size();
 
-    for (int i = 0; i < positions.cols(); ++i) {
-        const int array_index = convertGridIndexToArrayIndex(calcGridIndex(radius, positions, i));
+    // 1. Fit the grid to the predicted positions, with one empty cell of padding
+    const Vec3 min_pos = m_particles.p.colwise().minCoeff().transpose();
+    const Vec3 max_pos = m_particles.p.colwise().maxCoeff().transpose();
 
-        if (grid_cells.find(array_index) == grid_cells.end()) {
-            grid_cells[array_index] = std::vector<int>{ i };
-        }
-        else {
-            grid_cells[array_index].push_back(i);
+    const Scalar inv_cell_size = Scalar(1) / this->getSearchRadius();
+    const Eigen::Array3i min_cell = (min_pos * inv_cell_size).array().floor().template cast<int>();
+    const Eigen::Array3i max_cell = (max_pos * inv_cell_size).array().floor().template cast<int>();
+
+    m_grid_min = min_cell - 1;
+    m_grid_res = max_cell - min_cell + 3;
+
+    // Number of keys: the cell arrays are indexed by key, so with Morton keys they
+    // also hold the (always empty) keys that fall outside the grid. Dense grids past
+    // the cell cap (or a requested Hashed layout) use a table of 2N buckets instead.
+    const long long max_dense_cells = std::max(kMinDenseCells, kMaxCellsPerParticle * num_particles);
+    const long long grid_cells = static_cast<long long>(m_grid_res[0]) * m_grid_res[1] * m_grid_res[2];
+
+    m_active_key_mode = CellKeyMode::Hashed;
+    if (m_key_mode != CellKeyMode::Hashed && grid_cells <= max_dense_cells)
+    {
+        const CellKeyMode dense_mode = cellkey::effectiveMode(m_key_mode, m_grid_res[0], m_grid_res[1], m_grid_res[2]);
+        const bool fits = cellkey::keyCount(dense_mode, m_grid_res[0], m_grid_res[1], m_grid_res[2]) <= max_dense_cells;
+        m_active_key_mode = fits ? dense_mode : CellKeyMode::Linear;     // Linear keys = grid_cells
+    }
+
+    int num_cells = 0;
+    if (m_active_key_mode == CellKeyMode::Hashed)
+    {
+        m_hash_table_size = 1;
+        while (m_hash_table_size < 2 * num_particles)
+        {
+            m_hash_table_size <<= 1;
         }
+        num_cells = m_hash_table_size;
     }
+    else
+    {
+        num_cells = static_cast<int>(cellkey::keyCount(m_active_key_mode, m_grid_res[0], m_grid_res[1], m_grid_res[2]));
+    }
+
+    // The cap bounds every layout (dense keys and the hash table), so once reserved
+    // the cell arrays never reallocate when the grid moves or changes size
+    m_cell_start.reserve(max_dense_cells);
+    m_cell_end.reserve(max_dense_cells);
+
+    m_cell_keys.resize(num_particles);
+    m_cell_start.resize(num_cells);
+    m_cell_end.resize(num_cells);
+    m_sorted_indices.resize(num_particles);
+    m_thread_offsets.resize(omp_get_max_threads() + 1);
+
+    #pragma omp parallel
+    {
+        const int thread = omp_get_thread_num();
+        const int num_threads = omp_get_num_threads();
+        const auto [cell_begin, cell_end] = threadRange(num_cells, thread, num_threads);
+
+        // 2. Cell key of every particle + histogram (counts live in m_cell_end for now)
+        std::fill(m_cell_end.begin() + cell_begin, m_cell_end.begin() + cell_end, 0);
+
+        #pragma omp barrier
+
+        #pragma omp for
+        for (int i = 0; i < num_particles; ++i)
+        {
+            const int key = convertGridIndexToArrayIndex(calcGridIndex(m_particles.p.row(i).transpose()));
+            m_cell_keys[i] = key;
+
+            #pragma omp atomic
+            ++m_cell_end[key];
+        }
+
+        // 3. Exclusive prefix sum -> first slot of every cell (blocked: local scan, scan of block sums, fix-up)
+        int offset = 0;
+        for (int c = cell_begin; c < cell_end; ++c)
+        {
+            m_cell_start[c] = offset;
+            offset += m_cell_end[c];
+        }
+        m_thread_offsets[thread + 1] = offset;
+
+        #pragma omp barrier
+
+        #pragma omp single
+        {
+            m_thread_offsets[0] = 0;
+            for (int t = 0; t < num_threads; ++t)
+            {
+                m_thread_offsets[t + 1] += m_thread_offsets[t];
+            }
+        }
+
+        for (int c = cell_begin; c < cell_end; ++c)
+        {
+            m_cell_start[c] += m_thread_offsets[thread];
+            m_cell_end[c] = m_cell_start[c];
+        }
+
+        #pragma omp barrier
+
+        // 4. Scatter: m_cell_end works as the write cursor and ends one past the last slot
+        #pragma omp for
+        for (int i = 0; i < num_particles; ++i)
+        {
+            int slot;
 
-    return grid_cells;
+            #pragma omp atomic capture
+            slot = m_cell_end[m_cell_keys[i]]++;
+
+            m_sorted_indices[slot] = i;
+        }
+
+        // 5. The scatter order inside a cell depends on thread timing; sorting the (tiny)
+        //    cell ranges restores the stable, thread-count independent order
+        #pragma omp for schedule(static)
+        for (int c = 0; c < num_cells; ++c)
+        {
+            if (m_cell_end[c] - m_cell_start[c] > 1)
+            {
+                std::sort(m_sorted_indices.begin() + m_cell_start[c], m_sorted_indices.begin() + m_cell_end[c]);
+            }
+        }
+    }
 }
+
+template class HashGridT<float>;
+template class HashGridT<double>;
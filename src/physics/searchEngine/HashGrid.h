@@ -2,24 +2,66 @@
 #pragma once
 
 #include "NeighborSearchEngine.h"
+#include "../maths/CellKey.h"
 
-class HashGrid : public NeighborSearchEngine
+template <typename T>
+class HashGridT : public NeighborSearchEngineT<T>
 {
 public:
-	HashGrid(const Scalar radius, const std::vector<PBF_Particle>& particles);
+	using Base = NeighborSearchEngineT<T>;
+	using typename Base::Scalar;
+	using typename Base::ParticleData;
+	using Vec3 = Vec3T<T>;
+
+	HashGridT(const Scalar radius, const ParticleData& particles);
 
 	void searchNeighbors() override;
+
+	// Layout of the cell keys (see CellKey.h); the neighbor lists do not depend on it
+	inline void setKeyMode(const CellKeyMode mode) { m_key_mode = mode; }
+	inline CellKeyMode getKeyMode() const { return m_key_mode; }
+
+	// Layout of the last build: Hashed when the dense grid would exceed the cell cap
+	inline CellKeyMode getActiveKeyMode() const { return m_active_key_mode; }
+
+	// Dense cell arrays hold at most this many keys per particle (and at least kMinDenseCells):
+	// the fitted grid grows with the particle bounds, so a few stray particles would otherwise
+	// make every build O(domain volume). Larger grids use a hash table of 2N buckets.
+	static constexpr long long kMaxCellsPerParticle = 32;
+	static constexpr long long kMinDenseCells = 1 << 16;
 private:
+	using Base::m_neighbor_offsets;
+	using Base::m_neighbor_indices;
+	using Base::m_radius;
+	using Base::m_particles;
+
 	using GridIndex = std::tuple<int, int, int>;
 
-	GridIndex calcGridIndex(const Scalar radius, const MatX& positions, const int target_particle_index);
+	GridIndex calcGridIndex(const Vec3& position) const;
+
+	int convertGridIndexToArrayIndex(const GridIndex& index) const;
+
+	void constructGridCells();
+
+	// World-aligned grid of search-radius cells, fitted to the particle bounds at every build (padded by one cell)
+	Eigen::Array3i m_grid_min = Eigen::Array3i::Zero();
+	Eigen::Array3i m_grid_res = Eigen::Array3i::Zero();
+
+	// Linear by default: the CPU solver does not reorder its particles by cell, so Morton
+	// keys only change the cell arrays (which they make larger) and bring no speed-up here
+	CellKeyMode m_key_mode = CellKeyMode::Linear;
+	CellKeyMode m_active_key_mode = CellKeyMode::Linear;	// m_key_mode unless the grid is too large for it
+	int m_hash_table_size = 0;							// Hashed: buckets (power of two)
 
-	int convertGridIndexToArrayIndex(const GridIndex& index);
+	// Counting-sort cell layout (same as cellStart/cellEnd on the GPU)
+	std::vector<int> m_cell_keys;       // cell of each particle
+	std::vector<int> m_cell_start;      // first slot of each cell in m_sorted_indices
+	std::vector<int> m_cell_end;        // one past the last slot of each cell
+	std::vector<int> m_sorted_indices;  // particle indices ordered by cell
+	std::vector<int> m_thread_offsets;  // per-thread block sums of the cell prefix scan
 
-	std::unordered_map<int, std::vector<int>> constructGridCells(const Scalar radius, const MatX& positions);
+	// Per-thread neighbor buffers, merged into the CSR arrays of the base class
+	std::vector<std::vector<int>> m_thread_neighbors;
+};
 
-	const int  k_n_x = 128; // Sufficiently large value
-	const int  k_n_y = 128;
-	const int  k_n_z = 128;
-	const Vec3 k_grid_center = Vec3(0.0, 1.0, 0.0);
-};
\ No newline at end of file
+using HashGrid = HashGridT<Scalar>;
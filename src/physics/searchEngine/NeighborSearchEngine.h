@@ -4,28 +4,136 @@
 #include "../PBF_Particle.h"
 #include "../../support/Common.h"
 
+#include <algorithm>
 #include <map>
 #include <tuple>
 #include <unordered_map>
 #include <vector>
 
-class NeighborSearchEngine
+// Read-only view over the neighbors of one particle (a slice of the CSR index array)
+class NeighborSpan
 {
 public:
-    NeighborSearchEngine(const Scalar radius, const std::vector<PBF_Particle>& particles)
+    NeighborSpan(const int* begin, const int* end) : m_begin(begin), m_end(end) {}
+
+    inline const int* begin() const { return m_begin; }
+    inline const int* end() const { return m_end; }
+    inline const int* data() const { return m_begin; }
+    inline int size() const { return static_cast<int>(m_end - m_begin); }
+    inline bool empty() const { return m_begin == m_end; }
+    inline int operator[](const int k) const { return m_begin[k]; }
+private:
+    const int* m_begin;
+    const int* m_end;
+};
+
+template <typename T>
+class NeighborSearchEngineT
+{
+public:
+    using Scalar = T;
+    using ParticleData = PBF_ParticleDataT<T>;
+
+    NeighborSearchEngineT(const Scalar radius, const ParticleData& particles)
         : m_radius(radius), m_particles(particles) {}
 
+    virtual ~NeighborSearchEngineT() = default;
+
+    // Builds the lists with getSearchRadius() from the current predicted positions
     virtual void searchNeighbors() = 0;
 
-    inline const std::vector<int>& retrieveNeighbors(const int index) const
+    // Verlet lists: with a skin > 0 the lists hold every pair closer than radius + skin and
+    // are kept until some particle has moved more than skin / 2 since they were built, so
+    // no pair can have come within radius unnoticed. The extra pairs get zero kernel values.
+    // Returns true if the lists were rebuilt.
+    bool updateNeighbors();
+
+    // Forces a rebuild on the next updateNeighbors() (e.g. after the positions were replaced)
+    inline void invalidateNeighbors() { m_lists_valid = false; }
+
+    inline void setSkin(const Scalar skin) { m_skin = skin > Scalar(0) ? skin : Scalar(0); m_lists_valid = false; }
+    inline Scalar getSkin() const { return m_skin; }
+    inline Scalar getSearchRadius() const { return m_radius + m_skin; }
+
+    // List builds over updateNeighbors() calls (1 without a skin)
+    inline long long getNumBuilds() const { return m_num_builds; }
+    inline long long getNumUpdates() const { return m_num_updates; }
+    inline double getRebuildRate() const { return m_num_updates > 0 ? double(m_num_builds) / double(m_num_updates) : 0.0; }
+
+    inline NeighborSpan retrieveNeighbors(const int index) const
     {
-        return m_neighbors_list[index];
+        const int* indices = m_neighbor_indices.data();
+        return NeighborSpan(indices + m_neighbor_offsets[index], indices + m_neighbor_offsets[index + 1]);
     }
 
-    inline int getNumParticles() const { return m_neighbors_list.size(); }
+    // First entry of the neighbors of particle index in the CSR index array
+    inline int getNeighborOffset(const int index) const { return m_neighbor_offsets[index]; }
+
+    inline int getNumParticles() const { return m_neighbor_offsets.empty() ? 0 : m_neighbor_offsets.size() - 1; }
+    inline int getNumNeighbors() const { return m_neighbor_indices.size(); }
 protected:
-    std::vector<std::vector<int>>       m_neighbors_list;
+    // Compressed sparse rows: the neighbors of particle i are
+    // m_neighbor_indices[m_neighbor_offsets[i] .. m_neighbor_offsets[i + 1]).
+    // Both arrays are reused across steps and only grow.
+    std::vector<int>                    m_neighbor_offsets;
+    std::vector<int>                    m_neighbor_indices;
 
     const Scalar                        m_radius;
-    const std::vector<PBF_Particle>&    m_particles;
-};
\ No newline at end of file
+    const ParticleData&                 m_particles;
+
+private:
+    // Predicted positions at the last build (only kept with a skin)
+    typename ParticleData::Vec3Array    m_reference_positions;
+    Scalar                              m_skin = Scalar(0);
+    bool                                m_lists_valid = false;
+    long long                           m_num_builds = 0;
+    long long                           m_num_updates = 0;
+};
+
+template <typename T>
+bool NeighborSearchEngineT<T>::updateNeighbors()
+{
+    const int num_particles = m_particles.size();
+    ++m_num_updates;
+
+    bool rebuild = !m_lists_valid || m_skin <= Scalar(0) || getNumParticles() != num_particles;
+    if (!rebuild)
+    {
+        // Largest displacement since the build, compared squared
+        const Scalar* p_x = m_particles.p.col(0).data();
+        const Scalar* p_y = m_particles.p.col(1).data();
+        const Scalar* p_z = m_particles.p.col(2).data();
+        const Scalar* r_x = m_reference_positions.col(0).data();
+        const Scalar* r_y = m_reference_positions.col(1).data();
+        const Scalar* r_z = m_reference_positions.col(2).data();
+
+        Scalar max_squared = Scalar(0);
+        #pragma omp parallel for schedule(static) reduction(max : max_squared)
+        for (int i = 0; i < num_particles; ++i)
+        {
+            const Scalar d_x = p_x[i] - r_x[i];
+            const Scalar d_y = p_y[i] - r_y[i];
+            const Scalar d_z = p_z[i] - r_z[i];
+            max_squared = std::max(max_squared, d_x * d_x + d_y * d_y + d_z * d_z);
+        }
+
+        const Scalar half_skin = Scalar(0.5) * m_skin;
+        rebuild = max_squared > half_skin * half_skin;
+    }
+
+    if (!rebuild)
+    {
+        return false;
+    }
+
+    searchNeighbors();
+    if (m_skin > Scalar(0))
+    {
+        m_reference_positions = m_particles.p;
+    }
+    m_lists_valid = true;
+    ++m_num_builds;
+    return true;
+}
+
+using NeighborSearchEngine = NeighborSearchEngineT<Scalar>;
@@ -0,0 +1,87 @@
+// AllocationCounter.h
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+/**
+ * Counts heap allocations made by the process.
+ * With glibc every malloc is counted (operator new, Eigen's aligned allocations and
+ * the OpenMP runtime all end up there); elsewhere only the global operator new is
+ * replaced, so Eigen storage is not seen.
+ * Replacing the allocator is a whole-program decision, so it is only compiled in the
+ * one translation unit that defines SPHFLUID_ALLOCATION_COUNTER_IMPL before including
+ * this header (the benchmark); everywhere else only the counter is declared.
+ *
+ *     const std::size_t before = alloc::count();
+ *     system.Step(dt);
+ *     const std::size_t allocations = alloc::count() - before;
+ */
+namespace alloc
+{
+    std::atomic<std::size_t>& counter();
+
+    inline std::size_t count() { return counter().load(std::memory_order_relaxed); }
+}
+
+#if defined(SPHFLUID_ALLOCATION_COUNTER_IMPL)
+
+std::atomic<std::size_t>& alloc::counter()
+{
+    static std::atomic<std::size_t> allocations{ 0 };
+    return allocations;
+}
+
+#if defined(__GLIBC__)
+
+extern "C"
+{
+    void* __libc_malloc(std::size_t size);
+    void* __libc_calloc(std::size_t num, std::size_t size);
+    void* __libc_realloc(void* ptr, std::size_t size);
+
+    void* malloc(std::size_t size)
+    {
+        alloc::counter().fetch_add(1, std::memory_order_relaxed);
+        return __libc_malloc(size);
+    }
+
+    void* calloc(std::size_t num, std::size_t size)
+    {
+        alloc::counter().fetch_add(1, std::memory_order_relaxed);
+        return __libc_calloc(num, size);
+    }
+
+    void* realloc(void* ptr, std::size_t size)
+    {
+        alloc::counter().fetch_add(1, std::memory_order_relaxed);
+        return __libc_realloc(ptr, size);
+    }
+}
+
+#else
+
+void* operator new(std::size_t size)
+{
+    alloc::counter().fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+#endif
+
+#endif
@@ -10,7 +10,18 @@
 static constexpr float DEG2RAD = 3.14159265358979323846f / 180.0f;
 
 // USING
+// The CPU solver is templated on its scalar type and compiled for both float and
+// double; Scalar is only the default precision (SPHFLUID_SINGLE_PRECISION -> float).
+#if defined(SPHFLUID_SINGLE_PRECISION)
+using Scalar = float;
+#else
 using Scalar = double;
-using Vec3 = Eigen::Matrix<Scalar, 3, 1>;
-using VecX = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
-using MatX = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
\ No newline at end of file
+#endif
+
+template <typename T> using Vec3T = Eigen::Matrix<T, 3, 1>;
+template <typename T> using VecXT = Eigen::Matrix<T, Eigen::Dynamic, 1>;
+template <typename T> using MatXT = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+
+using Vec3 = Vec3T<Scalar>;
+using VecX = VecXT<Scalar>;
+using MatX = MatXT<Scalar>;
\ No newline at end of file
@@ -7,6 +7,8 @@
 #include <iostream>
 #include <cassert>
 
+#include "../graphics/GpuReadbackRing.h"
+
 namespace dbg
 {
 
@@ -20,6 +22,21 @@ namespace dbg
         return out;
     }
 
+    // Igual que readBuffer pero sin bloquear: copia la captura más antigua ya terminada
+    // del anillo (ring.capture(ssbo, frame) unos frames antes). false si aún no hay ninguna.
+    template<typename T>
+    bool tryReadBuffer(GpuReadbackRing& ring, std::vector<T>& out, uint64_t* frameId = nullptr)
+    {
+        GLsizeiptr sz = 0;
+        const T* data = ring.acquireAs<T>(frameId, &sz);
+        if (data == nullptr)
+            return false;
+
+        out.assign(data, data + sz / sizeof(T));
+        ring.release();
+        return true;
+    }
+
     inline bool isSorted(const std::vector<uint32_t>& v)
     {
         for (size_t i=1;i<v.size();++i)
@@ -88,3 +88,35 @@ void ImGuiLayer::ShowInfoPanel(AppInfo& info)
     ImGui::End();
 }
 
+void ImGuiLayer::ShowGpuTimingsPanel(GpuProfiler& profiler, double cpuUpdateGrid_ms)
+{
+    ImGui::Begin("GPU Timings");
+
+    bool enabled = profiler.isEnabled();
+    if (ImGui::Checkbox("Profiling", &enabled))
+        profiler.setEnabled(enabled);
+
+    ImGui::Text("Media de %d frames (ms / frame)", profiler.windowSize());
+    ImGui::Separator();
+
+    const double total = profiler.avgTotal_ms();
+    for (const auto& stage : profiler.stages())
+    {
+        const float fraction = total > 0.0 ? static_cast<float>(stage.avg_ms / total) : 0.0f;
+        ImGui::Text("%-16s %7.3f", stage.name.c_str(), stage.avg_ms);
+        ImGui::SameLine(190.0f);
+        ImGui::ProgressBar(fraction, ImVec2(120.0f, 0.0f));
+    }
+
+    ImGui::Separator();
+    ImGui::Text("%-16s %7.3f", "GPU total", total);
+    ImGui::Text("%-16s %7.3f", "CPU UpdateGrid", cpuUpdateGrid_ms);
+
+    if (ImGui::Button("Guardar CSV"))
+        profiler.writeCSV("gpu_timings.csv");
+    ImGui::SameLine();
+    if (ImGui::Button("Guardar JSON"))
+        profiler.writeJSON("gpu_timings.json");
+
+    ImGui::End();
+}
@@ -2,6 +2,7 @@
 #pragma once
 #include <GLFW/glfw3.h>
 #include "AppInfo.h"
+#include "../graphics/GpuProfiler.h"
 
 class ImGuiLayer
 {
@@ -18,6 +19,9 @@ public:
     // Usamos un & para poder modificar 'fov' directamente.
     void ShowInfoPanel(AppInfo& info);
 
+    // Tiempos GPU por etapa (media de la ventana del profiler) y volcado a CSV / JSON
+    void ShowGpuTimingsPanel(GpuProfiler& profiler, double cpuUpdateGrid_ms);
+
 private:
     // Podrías agregar configuración adicional si deseas
 };
@@ -0,0 +1,20 @@
+// Timer.h
+#pragma once
+#include <chrono>
+
+// Splits a function into timed stages: every lap() adds the time elapsed since the
+// previous lap (or since construction) to the given accumulator, in milliseconds.
+class StageTimer
+{
+public:
+    StageTimer() : m_last(std::chrono::steady_clock::now()) {}
+
+    inline void lap(double& accumulator_ms)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        accumulator_ms += std::chrono::duration<double, std::milli>(now - m_last).count();
+        m_last = now;
+    }
+private:
+    std::chrono::steady_clock::time_point m_last;
+};